@@ -3,9 +3,21 @@
 // - Página "/"  : Escáner de redes con barras (refresca cada 2 s). Escanea cada 12 s).
 // - Página "/admin?pass=admin1234": Panel para listas Blanca/Negra, "En espera", Log de Eventos y herramientas avanzadas.
 // - Gating: Todos los dispositivos nuevos (salvo la MAC pre-aprobada) se envían a "En espera".
+// - Reglas por MAC completa o por prefijo (OUI /24, /28, /36); la más específica gana y, a igual
+//   longitud, la lista negra prevalece.
 // - Persistencia en NVS (Preferences): allow (blanca), black (negra), alias por MAC.
+// - Arranque por etapas: AP, DNS y HTTP primero; listas, LittleFS y el primer escaneo en segundo plano
+//   (tiempos de cada fase en /metrics).
 // - Tu laptop está preagregada a la LISTA BLANCA (cambia MY_LAPTOP_MAC si hace falta).
-// - Nombres/Alias para las MAC.
+// - Nombres/Alias para las MAC y fabricante según el OUI (tabla en flash, ver tools/gen_oui.py).
+// - Métricas Prometheus: "/metrics?pass=..." (heap, NVS, eventos WiFi, latencias de loop y rutas).
+// - Alertas de APs suplantadores (ap_ssid / PROTECTED_SSIDS) y cambios de seguridad: "/api/alerts?pass=...".
+// - Historial por cliente (sesiones y RSSI a 1 s / 1 min / 1 h): "/api/history?pass=...[&mac=...]".
+// - Listas paginadas: "/api/list/<allow|black|connected|pending>?pass=...&offset=&limit=&q=&sort=".
+// - API: /api/scan, /api/state y /api/log responden CBOR con "Accept: application/cbor" o ?fmt=cbor
+//   (claves enteras según /api/schema, MACs de 6 bytes).
+// - Diagnóstico: "/api/bench?pass=..." (ENABLE_BENCH=1), "/api/storm?pass=..." (ENABLE_STORM=1)
+//   y "/api/trace?pass=..." (ENABLE_TRACE=1).
 //
 // Autor: Grupo 6 (Ketfer G)
 // Modificado para un look profesional y funcionalidades empresariales por Gemini 🚀
@@ -15,28 +27,152 @@
 #include <WebServer.h>
 #include <Preferences.h>
 #include <DNSServer.h>
+#include <uri/UriBraces.h>
 #include "FS.h"
 #include "LittleFS.h"
+#include <stdarg.h>
+#include <esp_timer.h>
+#include "oui_db.h"   // generado con tools/gen_oui.py
 
 // ===== CONFIG AP / ADMIN =====
 #define DEFAULT_AP_SSID            "ESP32_GRUPO6_TI"
 #define DEFAULT_AP_PASS            "12345678"
 #define ADMIN_PASSWORD     "admin1234"
 
+// ===== BENCHMARK =====
+// 1 = expone /api/bench?pass=... (mide las rutas calientes con el contador de ciclos)
+#ifndef ENABLE_BENCH
+#define ENABLE_BENCH 0
+#endif
+// 1 = expone /api/storm (reproduce ráfagas de asociaciones a través de WiFiEventHandler)
+#ifndef ENABLE_STORM
+#define ENABLE_STORM 0
+#endif
+// 1 = registra trazas de las rutas calientes en un anillo en RAM (/api/trace)
+#ifndef ENABLE_TRACE
+#define ENABLE_TRACE 0
+#endif
+#if ENABLE_BENCH
+#include <esp_heap_caps.h>
+#endif
+
+// ====== Contenedores de capacidad fija ======
+// Las tablas de larga vida (listas, conectados, espera, log, escaneo) guardan sus cadenas en línea y
+// tienen capacidad fija en tiempo de compilación: viven en .bss y no tocan el heap en régimen estable.
+template<size_t N>
+struct FixedStr {
+  char buf[N + 1];
+  uint16_t len;
+  FixedStr(): len(0) { buf[0] = 0; }
+  FixedStr(const char* s) { assign(s); }
+  FixedStr(const String& s) { assign(s.c_str(), s.length()); }
+  void assign(const char* s, size_t n){
+    if (n > N){
+      n = N;
+      while (n > 0 && ((uint8_t)s[n] & 0xC0) == 0x80) n--; // no cortar un carácter UTF-8
+    }
+    memcpy(buf, s, n); buf[n] = 0; len = n;
+  }
+  void assign(const char* s){ if (s) assign(s, strlen(s)); else clear(); }
+  void vformat(const char* fmt, va_list ap){
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    if (n < 0) n = 0;
+    if ((size_t)n > N){
+      // vsnprintf ya cortó en N: se descarta la secuencia UTF-8 final si quedó incompleta
+      int lead = N;
+      while (lead > 0 && ((uint8_t)buf[lead-1] & 0xC0) == 0x80) lead--;
+      n = N;
+      if (lead > 0){
+        uint8_t c = buf[lead-1];
+        size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        if (N - (lead-1) < need) n = lead - 1;
+      }
+      buf[n] = 0;
+    }
+    len = n;
+  }
+  void clear(){ buf[0] = 0; len = 0; }
+  FixedStr& operator=(const char* s){ assign(s); return *this; }
+  FixedStr& operator=(const String& s){ assign(s.c_str(), s.length()); return *this; }
+  const char* c_str() const { return buf; }
+  size_t length() const { return len; }
+  bool empty() const { return len == 0; }
+  bool operator==(const FixedStr& o) const { return len == o.len && memcmp(buf, o.buf, len) == 0; }
+  bool operator==(const char* s) const { return strcmp(buf, s) == 0; }
+  bool operator==(const String& s) const { return len == s.length() && memcmp(buf, s.c_str(), len) == 0; }
+  bool operator!=(const FixedStr& o) const { return !(*this == o); }
+  bool operator!=(const char* s) const { return !(*this == s); }
+};
+template<size_t N> String& operator+=(String& s, const FixedStr<N>& f){ s.concat(f.c_str(), f.length()); return s; }
+
+template<typename T, size_t N>
+class FixedVec {
+  T items[N];
+  uint16_t count = 0;
+public:
+  size_t size() const { return count; }
+  static constexpr size_t capacity(){ return N; }
+  bool full() const { return count >= N; }
+  T& operator[](size_t i){ return items[i]; }
+  const T& operator[](size_t i) const { return items[i]; }
+  T* data(){ return items; }
+  const T* data() const { return items; }
+  T* begin(){ return items; }
+  T* end(){ return items + count; }
+  const T* begin() const { return items; }
+  const T* end() const { return items + count; }
+  bool push(const T& v){ if (full()) return false; items[count++] = v; return true; }
+  void erase(size_t i){ for (size_t j=i+1;j<count;j++) items[j-1] = items[j]; count--; }
+  void clear(){ count = 0; }
+  // Compacta en su lugar conservando el orden
+  template<typename Pred> void removeIf(Pred drop){
+    size_t w = 0;
+    for (size_t i=0;i<count;i++){
+      if (drop(items[i])) continue;
+      if (w != i) items[w] = items[i];
+      w++;
+    }
+    count = w;
+  }
+};
+
+// Anillo de capacidad fija: push() sobrescribe el más antiguo; [0] es el más antiguo
+template<typename T, size_t N>
+class FixedRing {
+  T items[N];
+  uint16_t head = 0, count = 0;
+public:
+  size_t size() const { return count; }
+  static constexpr size_t capacity(){ return N; }
+  T& push(){
+    T& slot = items[(head + count) % N];
+    if (count < N) count++; else head = (head + 1) % N;
+    return slot;
+  }
+  const T& operator[](size_t i) const { return items[(head + i) % N]; }
+  T& last(){ return items[(head + count - 1) % N]; }
+  void pop(){ if (count){ head = (head + 1) % N; count--; } } // descarta el más viejo
+  void clear(){ head = count = 0; }
+};
+
+typedef FixedStr<17> MacStr;   // "AA:BB:CC:DD:EE:FF"
+typedef FixedStr<32> AliasStr;
+typedef FixedStr<32> SsidStr;  // 802.11: hasta 32 bytes
+
 // ===== SCANNER =====
 const unsigned long SCAN_INTERVAL_MS = 12000; // 12 s
-unsigned long lastScan = 0;
+static const uint32_t RSSI_INTERVAL_MS  = 2000;
+static const uint32_t PRUNE_INTERVAL_MS = 5000;
 
 struct NetRes {
-  String ssid;
-  String bssid;
+  SsidStr ssid;
+  MacStr bssid;
   int rssi;
   int ch;
   wifi_auth_mode_t enc;
 };
 static const int MAX_NETS = 60;
-NetRes nets[MAX_NETS];
-int netCount = 0;
+FixedVec<NetRes, MAX_NETS> nets;
 
 // ===== CONTROL DE ACCESO =====
 Preferences prefs;
@@ -50,20 +186,31 @@ static const uint32_t PENDING_TTL_MS = 5UL * 60UL * 1000UL; // 5 min
 
 // ⚠ Cambia esta MAC por la de tu laptop:
 const char* MY_LAPTOP_MAC = "D0:39:57-E4-FB-65"; 
+// ⚠ Otras redes propias a vigilar además de ap_ssid ("" = ninguna):
+static const char* const PROTECTED_SSIDS[] = { "" };
 
 struct Device {
-  String mac;
-  String alias; // Campo de alias
+  MacStr mac;
+  AliasStr alias; // Campo de alias
   uint32_t lastSeenMs;
   uint16_t aid;
   int8_t rssi;
 };
-String allowList[MAX_MACS]; int allowCount = 0;
-String blackList[MAX_MACS]; int blackCount = 0;
+typedef FixedVec<MacStr, MAX_MACS>      MacList;
+typedef FixedVec<Device, MAX_CONNECTED> ConnectedTable;
+typedef FixedVec<Device, MAX_PENDING>   PendingTable;
+MacList allowList;
+MacList blackList;
 bool filteringEnabled = true;
 
-Device connected[MAX_CONNECTED]; int connectedCount = 0;
-Device pending[MAX_PENDING];       int pendingCount     = 0;
+ConnectedTable connected;
+PendingTable pending;
+
+// Vistas ordenadas de las tablas (ver /api/list): un bit por tabla que cambió desde el último índice
+enum ListId : uint8_t { L_ALLOW, L_BLACK, L_CONNECTED, L_PENDING, L_COUNT };
+uint8_t viewDirty = 0xFF;
+inline void viewTouch(ListId l){ viewDirty |= 1 << l; }
+void viewSeen(ListId l, uint16_t i);
 
 // Almacenamiento de alias
 Preferences aliasPrefs;
@@ -73,36 +220,254 @@ Preferences apConfig;
 String ap_ssid = DEFAULT_AP_SSID;
 String ap_pass = DEFAULT_AP_PASS;
 
+// ====== Métricas ======
+// Contadores estáticos + histogramas de latencia de cubetas fijas, exportados en /metrics (texto Prometheus).
+static const int HIST_BUCKETS = 8;
+static const uint32_t HIST_BOUNDS_US[HIST_BUCKETS - 1] = {100, 500, 1000, 5000, 20000, 100000, 500000}; // + Inf
+struct LatencyHist {
+  uint32_t count;
+  uint64_t sumUs;
+  uint32_t maxUs;
+  uint32_t buckets[HIST_BUCKETS]; // no acumulativas; se acumulan al exportar
+};
+void histObserve(LatencyHist& h, uint32_t us){
+  int b = 0;
+  while (b < HIST_BUCKETS - 1 && us >= HIST_BOUNDS_US[b]) b++;
+  h.buckets[b]++;
+  h.count++;
+  h.sumUs += us;
+  if (us > h.maxUs) h.maxUs = us;
+}
+
+struct Metrics {
+  LatencyHist loop, scan, dns;
+  uint32_t nvsReads, nvsWrites;
+  uint32_t staConnected, staDisconnected, staPending, deauthSent;
+  uint32_t staBlocked, staPenalized, logSuppressed;
+  uint32_t scans, scanResults, scanLastMs;
+  uint32_t scanNotModified, scanGzip;
+  uint32_t apiCbor;
+  uint32_t viewRebuilds;
+  uint32_t rogueAlerts;
+  uint32_t bootDeferDropped;
+  uint32_t logEvents;
+};
+Metrics metrics = {};
+
+struct RouteMetric {
+  const char* path;
+  LatencyHist h;
+};
+static const int MAX_ROUTES = 40;
+RouteMetric routeMetrics[MAX_ROUTES];
+int routeCount = 0;
+
+// Marcas del arranque (µs desde el inicio según esp_timer); 0 = fase aún no alcanzada
+enum BootPhase { BOOT_CONFIG, BOOT_AP, BOOT_HTTP, BOOT_FIRST_REQUEST, BOOT_FS, BOOT_LISTS, BOOT_FIRST_SCAN, BOOT_COUNT };
+static const char* const BOOT_PHASE_NAMES[BOOT_COUNT] = {
+  "config", "ap", "http", "first_request", "fs", "lists", "first_scan"
+};
+uint32_t bootUs[BOOT_COUNT];
+void bootMark(BootPhase p){ if (!bootUs[p]) bootUs[p] = (uint32_t)esp_timer_get_time(); }
+
+// ====== Trazas (ENABLE_TRACE) ======
+// Registro de inicio/fin de regiones instrumentadas en un anillo fijo en RAM (8 bytes por registro).
+// GET /api/trace?pass=...          -> binario: "ESTR", versión, nº de registros, registros y tabla de nombres
+// GET /api/trace?pass=...&fmt=json -> Chrome trace-event JSON (abrir en chrome://tracing o Perfetto)
+// &clear=1 vacía el anillo después de descargarlo. Con ENABLE_TRACE=0 TRACE_SCOPE no genera código.
+enum TraceTag : uint16_t {
+  TR_HANDLE_CLIENT = 1,
+  TR_DNS,
+  TR_RUN_SCAN,
+  TR_RSSI,
+  TR_PRUNE,
+  TR_NVS_READ,
+  TR_NVS_WRITE,
+  TR_WIFI_EVENT,
+  TR_ROUTE_BASE = 64  // + índice en routeMetrics
+};
+
+#if ENABLE_TRACE
+static const int TRACE_CAPACITY = 1024;
+struct TraceRec {
+  uint32_t tsUs;
+  uint16_t tag;
+  uint8_t phase;  // 'B' inicio, 'E' fin
+  uint8_t tid;    // índice de tarea (loop, eventos WiFi, ...)
+};
+TraceRec traceRing[TRACE_CAPACITY];
+uint32_t traceHead = 0, traceCount = 0;
+TaskHandle_t traceTasks[4];
+portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+
+void traceRecord(uint16_t tag, uint8_t phase){
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  portENTER_CRITICAL(&traceMux);
+  uint8_t tid = 0;
+  while (tid < 4 && traceTasks[tid] && traceTasks[tid] != self) tid++;
+  if (tid < 4 && !traceTasks[tid]) traceTasks[tid] = self;
+  TraceRec &r = traceRing[traceHead];
+  r.tsUs = micros(); r.tag = tag; r.phase = phase; r.tid = tid;
+  traceHead = (traceHead + 1) % TRACE_CAPACITY;
+  if (traceCount < TRACE_CAPACITY) traceCount++;
+  portEXIT_CRITICAL(&traceMux);
+}
+struct TraceScope {
+  uint16_t tag;
+  TraceScope(uint16_t t): tag(t) { traceRecord(tag, 'B'); }
+  ~TraceScope() { traceRecord(tag, 'E'); }
+};
+#define TRACE_CAT2(a,b) a##b
+#define TRACE_CAT(a,b) TRACE_CAT2(a,b)
+#define TRACE_SCOPE(tag) TraceScope TRACE_CAT(_trace_, __LINE__)(tag)
+#else
+#define TRACE_SCOPE(tag) do {} while (0)
+#endif
+
 // ===== Log de eventos =====
 struct LogEvent {
   uint32_t timestamp;
-  String message;
+  FixedStr<127> message;
 };
 const int MAX_LOG_EVENTS = 50;
-LogEvent eventLog[MAX_LOG_EVENTS];
-int logCount = 0;
+typedef FixedRing<LogEvent, MAX_LOG_EVENTS> LogRing;
+LogRing eventLog;
 
 void logEvent(const String& message) {
-  if (logCount < MAX_LOG_EVENTS) {
-    eventLog[logCount].timestamp = millis();
-    eventLog[logCount].message = message;
-    logCount++;
-  } else {
-    for (int i = 0; i < MAX_LOG_EVENTS - 1; ++i) {
-      eventLog[i] = eventLog[i + 1];
-    }
-    eventLog[MAX_LOG_EVENTS - 1].timestamp = millis();
-    eventLog[MAX_LOG_EVENTS - 1].message = message;
+  metrics.logEvents++;
+  LogEvent &e = eventLog.push();
+  e.timestamp = millis();
+  e.message = message;
+}
+// Variante printf que escribe directo en el anillo (sin String temporales)
+void logEventf(const char* fmt, ...) {
+  metrics.logEvents++;
+  LogEvent &e = eventLog.push();
+  e.timestamp = millis();
+  va_list ap; va_start(ap, fmt);
+  e.message.vformat(fmt, ap);
+  va_end(ap);
+}
+
+// ====== Planificador cooperativo ======
+// Sustituye los temporizadores sueltos de loop(). Cada trabajo tiene un deadline (nextMs), periodo
+// (0 = una sola vez), presupuesto de tiempo y prioridad (0 = más urgente). loop() atiende primero
+// HTTP y DNS y después schedRun() ejecuta como mucho UN trabajo vencido por iteración, así ningún
+// lote de tareas de mantenimiento se acumula delante de los clientes.
+typedef void (*JobFn)();
+struct Job {
+  const char* name;
+  JobFn fn;
+  uint32_t periodMs;
+  uint32_t nextMs;
+  uint32_t budgetUs;
+  uint8_t priority;
+  bool active;
+  uint32_t runs, overruns;
+  uint32_t maxJitterMs; // atraso máximo al arrancar respecto del deadline
+  LatencyHist h;
+};
+static const int MAX_JOBS = 12;
+Job jobs[MAX_JOBS];
+int jobCount = 0;
+
+int schedAdd(const char* name, JobFn fn, uint32_t periodMs, uint32_t firstDelayMs, uint32_t budgetUs, uint8_t priority){
+  // Reutiliza ranuras de trabajos de una sola vez ya terminados
+  int id = 0;
+  while (id < jobCount && jobs[id].active) id++;
+  if (id == jobCount){ if (jobCount >= MAX_JOBS) return -1; jobCount++; }
+  jobs[id] = {};
+  jobs[id].name = name; jobs[id].fn = fn;
+  jobs[id].periodMs = periodMs; jobs[id].nextMs = millis() + firstDelayMs;
+  jobs[id].budgetUs = budgetUs; jobs[id].priority = priority;
+  jobs[id].active = true;
+  return id;
+}
+int schedEvery(const char* name, JobFn fn, uint32_t periodMs, uint32_t phaseMs, uint32_t budgetUs, uint8_t priority){
+  return schedAdd(name, fn, periodMs, phaseMs, budgetUs, priority);
+}
+int schedOnce(const char* name, JobFn fn, uint32_t delayMs, uint32_t budgetUs, uint8_t priority){
+  return schedAdd(name, fn, 0, delayMs, budgetUs, priority);
+}
+// Adelanta un trabajo periódico para que corra en la próxima iteración
+void schedKick(int id){
+  if (id >= 0 && id < jobCount && jobs[id].active) jobs[id].nextMs = millis();
+}
+
+void schedRun(){
+  uint32_t now = millis();
+  int pick = -1;
+  for (int i=0;i<jobCount;i++){
+    const Job &j = jobs[i];
+    if (!j.active || (int32_t)(now - j.nextMs) < 0) continue;
+    if (pick < 0 || j.priority < jobs[pick].priority ||
+        (j.priority == jobs[pick].priority && (int32_t)(j.nextMs - jobs[pick].nextMs) < 0)) pick = i;
   }
+  if (pick < 0) return;
+
+  Job &j = jobs[pick];
+  uint32_t jitter = now - j.nextMs;
+  if (jitter > j.maxJitterMs) j.maxJitterMs = jitter;
+  uint32_t t0 = micros();
+  j.fn();
+  uint32_t took = micros() - t0;
+  histObserve(j.h, took);
+  j.runs++;
+  if (took > j.budgetUs) j.overruns++;
+
+  if (!j.periodMs){ j.active = false; return; }
+  // Mantiene la fase; si se perdió más de un periodo no intenta recuperar las ejecuciones atrasadas
+  j.nextMs += j.periodMs;
+  uint32_t after = millis();
+  if ((int32_t)(after - j.nextMs) > (int32_t)j.periodMs) j.nextMs = after + j.periodMs;
 }
 
 // ====== Utils comunes ======
-String macToStr(const uint8_t* bssid){
-  char buf[18];
-  snprintf(buf,sizeof(buf),"%02X:%02X:%02X:%02X:%02X:%02X",
+void macToBuf(const uint8_t* bssid, char* out){ // out: 18 bytes
+  snprintf(out,18,"%02X:%02X:%02X:%02X:%02X:%02X",
     bssid[0],bssid[1],bssid[2],bssid[3],bssid[4],bssid[5]);
+}
+String macToStr(const uint8_t* bssid){
+  char buf[18]; macToBuf(bssid, buf);
   return String(buf);
 }
+MacStr macFromBytes(const uint8_t* bssid){
+  char buf[18]; macToBuf(bssid, buf);
+  return MacStr(buf);
+}
+uint64_t macToU64(const uint8_t* m){
+  return ((uint64_t)m[0]<<40)|((uint64_t)m[1]<<32)|((uint64_t)m[2]<<24)|((uint64_t)m[3]<<16)|((uint64_t)m[4]<<8)|m[5];
+}
+// Dígitos hex de una MAC/regla canónica (AA:BB:CC[:D]...) alineados a la izquierda en 48 bits
+uint64_t macStrToU64(const char* m, int* digits = nullptr){
+  uint64_t v = 0; int n = 0;
+  for (; *m && *m != '/' && n < 12; ++m){
+    char c = *m;
+    if (c>='0'&&c<='9') v = (v<<4) | (c-'0');
+    else if (c>='A'&&c<='F') v = (v<<4) | (c-'A'+10);
+    else continue;
+    n++;
+  }
+  if (digits) *digits = n;
+  return v << (4*(12-n));
+}
+
+// Fabricante por OUI: hash perfecto mínimo sobre arreglos constexpr (flash, sin RAM).
+// Cubeta -> desplazamiento -> única posición candidata; la clave guardada descarta OUIs ausentes.
+constexpr uint32_t ouiMix(uint32_t x){
+  x ^= x >> 16; x *= 0x85EBCA6Bu; x ^= x >> 13; x *= 0xC2B2AE35u; x ^= x >> 16;
+  return x;
+}
+const char* ouiLookup(uint32_t oui){
+  uint32_t d = OUI_DISP[ouiMix(oui ^ OUI_SEED) % OUI_BUCKETS];
+  uint32_t s = ouiMix(oui ^ (d * 0x9E3779B9u)) % OUI_COUNT;
+  return OUI_KEYS[s] == oui ? OUI_NAMES + OUI_NAME_OFF[OUI_NAME_IDX[s]] : "";
+}
+const char* macVendor(uint64_t mac){
+  if ((mac >> 40) & 0x02) return "MAC aleatoria"; // bit de administración local (p.ej. privacidad en móviles)
+  return ouiLookup((uint32_t)(mac >> 24));
+}
+const char* macVendor(const char* mac){ return macVendor(macStrToU64(mac)); }
 bool isHexDigit(char c){ return (c>='0'&&c<='9')||(c>='A'&&c<='F'); }
 String toUpperNoSpaces(const String& s){
   String r; r.reserve(s.length());
@@ -118,16 +483,40 @@ bool normalizeMac(String in, String &out){
   for (int i=0;i<12;i+=2){ if(i) out += ":"; out += hex.substring(i,i+2); }
   return true;
 }
-String jsonEscape(const String& in){
-  String o; o.reserve(in.length()+4);
-  for (size_t i=0;i<in.length();++i){
-    char c = in[i];
+// Regla de acceso: MAC completa o prefijo de 24/28/36 bits. Acepta "AA:BB:CC/24", "AA:BB:CC:*",
+// "aabbcc0/28" o "AA:BB:CC:00:00:00/24". Forma canónica: "AA:BB:CC/24", "AA:BB:CC:D/28", "AA:BB:CC:DD:E/36"
+// (cabe en MacStr, así que las listas y su CSV en NVS no cambian de formato).
+bool normalizeRule(String in, String &out){
+  String s = toUpperNoSpaces(in);
+  int len = 48;
+  int slash = s.indexOf('/');
+  bool star = s.endsWith("*");
+  if (slash >= 0){ len = s.substring(slash+1).toInt(); s = s.substring(0, slash); }
+  String hex; hex.reserve(12);
+  for (char c: s) if (isHexDigit(c)) hex += c;
+  if (star && slash < 0) len = hex.length()*4;
+  if (len!=24 && len!=28 && len!=36 && len!=48) return false;
+  if ((int)hex.length() != len/4){
+    if (hex.length()!=12) return false;
+    for (int i=len/4;i<12;i++) if (hex[i]!='0') return false;
+    hex = hex.substring(0, len/4);
+  }
+  out = "";
+  for (int i=0;i<(int)hex.length();i+=2){ if(i) out += ":"; out += hex.substring(i,i+2); }
+  if (len < 48){ out += "/"; out += String(len); }
+  return true;
+}
+String jsonEscape(const char* in){
+  String o; o.reserve(strlen(in)+4);
+  for (; *in; ++in){
+    char c = *in;
     if (c=='\\' || c=='"') { o += '\\'; o += c; }
     else if ((unsigned char)c < 0x20) { o += ' '; }
     else { o += c; }
   }
   return o;
 }
+String jsonEscape(const String& in){ return jsonEscape(in.c_str()); }
 String timeAgo(uint32_t ms) {
     uint32_t seconds = ms / 1000;
     if (seconds < 60) {
@@ -147,7 +536,7 @@ int qualityFromRSSI(int rssi){
   if (rssi >= -50)  return 100;
   return 2 * (rssi + 100);
 }
-String encTypeToStr(wifi_auth_mode_t e){
+const char* encTypeToStr(wifi_auth_mode_t e){
   switch(e){
     case WIFI_AUTH_OPEN:              return "Abierta";
     case WIFI_AUTH_WEP:                return "WEP";
@@ -165,306 +554,1579 @@ String encTypeToStr(wifi_auth_mode_t e){
   }
 }
 
-// ====== Scanner core ======
-void runScan(){
-  int n = WiFi.scanNetworks(false, true); // sync + hidden
-  netCount = 0;
-  if (n <= 0){ WiFi.scanDelete(); return; }
-
-  int* idx = (int*)malloc(n*sizeof(int));
-  for (int i=0;i<n;i++) idx[i]=i;
-  for (int a=0;a<n-1;a++){
-    for (int b=a+1;b<n;b++){
-      if (WiFi.RSSI(idx[b]) > WiFi.RSSI(idx[a])){
-        int t=idx[a]; idx[a]=idx[b]; idx[b]=t;
+// ====== Serialización (JSON / CBOR) ======
+// Cada documento de la API se describe una sola vez (emitState, emitScan, emitLog) sobre un Emitter
+// que escribe JSON o CBOR (RFC 8949): así ambos formatos no se desincronizan. En CBOR las claves son
+// enteros (ApiKey), las MACs viajan como 6 bytes crudos y los números como enteros. La salida pasa por un buffer chico que se vacía en
+// un sumidero: la respuesta HTTP (chunked), un String o un buffer fijo.
+// Claves de los documentos: texto en JSON, entero pequeño en CBOR (1 byte en el cable).
+// El orden es parte del contrato con los clientes CBOR: sólo se agregan al final. /api/schema publica la tabla.
+enum ApiKey : uint8_t {
+  K_SSID = 0, K_BSSID, K_VENDOR, K_RSSI, K_QUALITY, K_CHANNEL, K_SECURITY, K_AP_SSID, K_AP_PASS,
+  K_FILTERING, K_ALLOWED, K_MAC, K_ALIAS, K_BLACK, K_CONNECTED, K_SEEN_MS, K_AID, K_PENDING,
+  K_NEW_PENDING, K_TIME, K_AGE_MS, K_MESSAGE, K_NAME, K_TOTAL, K_OFFSET, K_ITEMS, K_MATCHED,
+  K_ONLINE, K_CONNECTS, K_QUICK_RECONNECTS, K_FIRST_AGE_S, K_LAST_AGE_S, K_SESSIONS, K_START_AGE_S,
+  K_END_AGE_S, K_RES_S, K_POINTS, K_RSSI_1S, K_RSSI_1M, K_RSSI_1H, K_CLIENTS, K_KIND, K_PREV_SECURITY, K_COUNT
+};
+static const char* const API_KEY_NAMES[K_COUNT] = {
+  "ssid", "bssid", "vendor", "rssi", "quality", "channel", "security", "ap_ssid", "ap_pass",
+  "filtering", "allowed", "mac", "alias", "black", "connected", "seen_ms", "aid", "pending",
+  "newPending", "time", "age_ms", "message", "name", "total", "offset", "items", "matched",
+  "online", "connects", "quick_reconnects", "first_age_s", "last_age_s", "sessions", "start_age_s",
+  "end_age_s", "res_s", "points", "rssi_1s", "rssi_1m", "rssi_1h", "clients", "kind", "prev_security"
+};
+
+// Largo de la secuencia UTF-8 bien formada que empieza en s (sin overlongs ni sustitutos); 0 si no la hay
+size_t utf8Seq(const uint8_t* s){
+  uint8_t c = s[0];
+  if (c < 0x80) return 1;
+  size_t n = c >= 0xF5 ? 0 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC2 ? 2 : 0;
+  for (size_t i=1;i<n;i++) if ((s[i] & 0xC0) != 0x80) return 0;
+  if ((c == 0xE0 && s[1] < 0xA0) || (c == 0xED && s[1] >= 0xA0) ||
+      (c == 0xF0 && s[1] < 0x90) || (c == 0xF4 && s[1] >= 0x90)) return 0;
+  return n;
+}
+
+struct Emitter {
+  typedef void (*SinkFn)(void* ctx, const uint8_t* p, size_t n);
+  static const int MAX_DEPTH = 8;
+  bool cbor;
+  SinkFn sink; void* ctx;
+  size_t total = 0;                   // bytes ya entregados al sumidero
+  uint8_t buf[512]; size_t len = 0;
+  bool first[MAX_DEPTH], indef[MAX_DEPTH]; int depth = 0;
+  bool afterKey = false;
+
+  Emitter(bool c, SinkFn fn, void* cx) : cbor(c), sink(fn), ctx(cx) {}
+  size_t size() const { return total + len; }
+  void flush(){ if (len){ sink(ctx, buf, len); total += len; len = 0; } }
+  void put(uint8_t b){ if (len == sizeof(buf)) flush(); buf[len++] = b; }
+  void put(const char* s, size_t n){ while (n--) put((uint8_t)*s++); }
+  void head(uint8_t major, uint32_t v){ // CBOR: tipo mayor + argumento
+    major <<= 5;
+    if (v < 24) put(major | v);
+    else if (v < 0x100){ put(major | 24); put(v); }
+    else if (v < 0x10000){ put(major | 25); put(v >> 8); put(v); }
+    else { put(major | 26); put(v >> 24); put(v >> 16); put(v >> 8); put(v); }
+  }
+  void sep(){ // JSON: coma entre elementos
+    if (afterKey){ afterKey = false; return; }
+    if (depth > 0){ if (!first[depth-1]) put(','); first[depth-1] = false; }
+  }
+  void open(char c, uint8_t major, int n){
+    if (cbor){ if (n < 0) put((major << 5) | 31); else head(major, n); }
+    else { sep(); put(c); }
+    if (depth < MAX_DEPTH){ first[depth] = true; indef[depth] = n < 0; }
+    depth++;
+  }
+  void close(char c){
+    depth--;
+    if (!cbor) put(c);
+    else if (depth < MAX_DEPTH && indef[depth]) put(0xFF);
+  }
+  // n = cantidad de elementos (pares en objetos); -1 si no se conoce de antemano
+  void beginObj(int n = -1){ open('{', 5, n); }
+  void endObj(){ close('}'); }
+  void beginArr(int n = -1){ open('[', 4, n); }
+  void endArr(){ close(']'); }
+  void key(ApiKey id){
+    if (cbor){ head(0, id); return; }
+    const char* k = API_KEY_NAMES[id];
+    sep(); put('"'); put(k, strlen(k)); put('"'); put(':');
+    afterKey = true;
+  }
+  // Texto: lo que no es UTF-8 válido (un SSID puede traer cualquier byte) sale como U+FFFD, así el
+  // tipo 3 de CBOR y el JSON quedan bien formados. En CBOR el largo va adelante: se mide primero.
+  void str(const char* s){
+    const uint8_t* p = (const uint8_t*)s;
+    if (cbor){
+      size_t n = 0;
+      for (const uint8_t* q = p; *q; ){ size_t k = utf8Seq(q); n += k ? k : 3; q += k ? k : 1; }
+      head(3, n);
+    } else { sep(); put('"'); }
+    while (*p){
+      size_t k = utf8Seq(p);
+      if (!k){ put("\xEF\xBF\xBD", 3); p++; continue; }
+      char c = *p;
+      if (cbor || k > 1) put((const char*)p, k);
+      else if (c=='\\' || c=='"'){ put('\\'); put(c); }
+      else put((unsigned char)c < 0x20 ? ' ' : c);
+      p += k;
+    }
+    if (!cbor) put('"');
+  }
+  void num(int32_t v){
+    if (cbor){ if (v >= 0) head(0, v); else head(1, (uint32_t)(-1 - v)); return; }
+    sep(); char t[12]; int n = snprintf(t, sizeof(t), "%ld", (long)v); put(t, n);
+  }
+  void nul(){ if (cbor) put(0xF6); else { sep(); put("null", 4); } }
+  void boolean(bool b){
+    if (cbor){ put(b ? 0xF5 : 0xF4); return; }
+    sep(); b ? put("true", 4) : put("false", 5);
+  }
+  // MAC canónica: 6 bytes en CBOR; las reglas de prefijo (AA:BB:CC/24) quedan como texto
+  void mac(const char* m){
+    if (!cbor || strlen(m) != 17){ str(m); return; }
+    uint64_t v = macStrToU64(m);
+    head(2, 6);
+    for (int i=5;i>=0;i--) put((uint8_t)(v >> (8*i)));
+  }
+};
+
+void stringSink(void* ctx, const uint8_t* p, size_t n){ ((String*)ctx)->concat((const char*)p, n); }
+struct FixedSink { uint8_t* p; size_t cap, len; };
+void fixedSink(void* ctx, const uint8_t* p, size_t n){
+  FixedSink* f = (FixedSink*)ctx;
+  if (n > f->cap - f->len) n = f->cap - f->len;
+  memcpy(f->p + f->len, p, n); f->len += n;
+}
+void httpSink(void*, const uint8_t* p, size_t n){ server.sendContent_P((PGM_P)p, n); }
+
+// Negociación: ?fmt=cbor o "Accept: application/cbor"; por defecto JSON
+bool wantCbor(){
+  return server.arg("fmt") == "cbor" || server.header("Accept").indexOf("application/cbor") >= 0;
+}
+// Envía un documento en streaming (chunked): no se arma la respuesta completa en RAM
+void streamDoc(bool cbor, void (*emit)(Emitter&)){
+  if (cbor) metrics.apiCbor++;
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, cbor ? "application/cbor" : "application/json", "");
+  Emitter e(cbor, httpSink, nullptr);
+  emit(e);
+  e.flush();
+  server.sendContent("");
+}
+void sendDoc(void (*emit)(Emitter&)){
+  server.sendHeader("Vary", "Accept");
+  streamDoc(wantCbor(), emit);
+}
+
+// ====== Caché de /api/scan ======
+// La respuesta sólo cambia cuando termina runScan(): se serializa una vez, junto con su variante gzip
+// y un ETag (CRC32 del JSON), y cada petición se sirve directo desde estos buffers estáticos.
+static const size_t SCAN_JSON_MAX = 12288; // MAX_NETS entradas del peor caso (~200 B) con holgura
+static const size_t SCAN_GZ_MAX   = 6144;  // si el gzip no cabe se sirve sólo el JSON
+static const int    GZ_HASH_BITS  = 10;
+char    scanJson[SCAN_JSON_MAX] = "[]";
+size_t  scanJsonLen = 2;
+uint8_t scanGz[SCAN_GZ_MAX];
+size_t  scanGzLen = 0;
+char    scanEtag[12] = "\"0\"";
+
+uint32_t crc32(const uint8_t* p, size_t n){
+  static const uint32_t T[16] = {
+    0x00000000,0x1DB71064,0x3B6E20C8,0x26D930AC,0x76DC4190,0x6B6B51F4,0x4DB26158,0x5005713C,
+    0xEDB88320,0xF00F9344,0xD6D6A3E8,0xCB61B38C,0x9B64C2B0,0x86D3D2D4,0xA00AE278,0xBDBDF21C };
+  uint32_t c = 0xFFFFFFFF;
+  while (n--){ c ^= *p++; c = (c >> 4) ^ T[c & 15]; c = (c >> 4) ^ T[c & 15]; }
+  return ~c;
+}
+
+// gzip mínimo: LZ77 con una tabla hash de un candidato y códigos Huffman fijos (RFC 1951 3.2.6).
+// Para JSON con claves repetidas basta para reducir el tamaño ~3-4x sin tablas dinámicas.
+struct BitOut {
+  uint8_t* buf; size_t cap, len; uint32_t acc; int n; bool ok;
+  void byte(uint8_t b){ if (len < cap) buf[len++] = b; else ok = false; }
+  void bits(uint32_t v, int cnt){ acc |= v << n; n += cnt; while (n >= 8){ byte(acc & 0xFF); acc >>= 8; n -= 8; } }
+  void huff(uint32_t code, int cnt){ uint32_t r = 0; for (int i=0;i<cnt;i++) r = (r << 1) | ((code >> i) & 1); bits(r, cnt); }
+  void flush(){ if (n) byte(acc & 0xFF); acc = 0; n = 0; }
+};
+void deflateSym(BitOut& o, int c){
+  if (c < 144)      o.huff(0x30 + c, 8);
+  else if (c < 256) o.huff(0x190 + c - 144, 9);
+  else if (c < 280) o.huff(c - 256, 7);
+  else              o.huff(0xC0 + c - 280, 8);
+}
+void deflateMatch(BitOut& o, int len, int dist){
+  static const uint16_t LB[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+  static const uint8_t  LX[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+  static const uint16_t DB[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,
+                                  4097,6145,8193,12289,16385,24577};
+  static const uint8_t  DX[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+  int i = 28; while (len < LB[i]) i--;
+  deflateSym(o, 257 + i); if (LX[i]) o.bits(len - LB[i], LX[i]);
+  int d = 29; while (dist < DB[d]) d--;
+  o.huff(d, 5); if (DX[d]) o.bits(dist - DB[d], DX[d]);
+}
+size_t gzipTo(const uint8_t* in, size_t n, uint8_t* out, size_t cap){
+  static uint16_t head[1 << GZ_HASH_BITS]; // posición+1 de la última aparición de cada trigrama
+  memset(head, 0, sizeof(head));
+  static const uint8_t hdr[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+  BitOut o = {out, cap, 0, 0, 0, true};
+  for (uint8_t b : hdr) o.byte(b);
+  o.bits(1, 1); o.bits(1, 2); // último bloque, Huffman fijo
+  auto hash = [&](size_t i){ return ((in[i] << 10) ^ (in[i+1] << 5) ^ in[i+2]) & ((1 << GZ_HASH_BITS) - 1); };
+  size_t i = 0;
+  while (i < n && o.ok){
+    int best = 0, dist = 0;
+    if (i + 2 < n){
+      uint32_t h = hash(i);
+      size_t cand = head[h]; head[h] = i + 1;
+      if (cand && i - (cand - 1) <= 32768){
+        size_t p = cand - 1; int l = 0;
+        while (l < 258 && i + l < n && in[p + l] == in[i + l]) l++;
+        if (l >= 3){ best = l; dist = i - p; }
       }
     }
+    if (best){
+      deflateMatch(o, best, dist);
+      for (size_t k = i + 1; k < i + best && k + 2 < n; k++) head[hash(k)] = k + 1;
+      i += best;
+    } else deflateSym(o, in[i++]);
+  }
+  deflateSym(o, 256);
+  o.flush();
+  uint32_t crc = crc32(in, n);
+  for (int k=0;k<4;k++) o.byte(crc >> (8*k));
+  for (int k=0;k<4;k++) o.byte(n >> (8*k));
+  return o.ok ? o.len : 0;
+}
+
+void emitScan(Emitter& e, size_t budget = SIZE_MAX){
+  e.beginArr();
+  for (size_t i=0;i<nets.size();i++){
+    if (e.size() + 320 > budget) break; // peor caso de una entrada: la lista queda válida aunque se corte
+    e.beginObj(7);
+    e.key(K_SSID);     e.str(nets[i].ssid.c_str());
+    e.key(K_BSSID);    e.mac(nets[i].bssid.c_str());
+    e.key(K_VENDOR);   e.str(macVendor(nets[i].bssid.c_str()));
+    e.key(K_RSSI);     e.num(nets[i].rssi);
+    e.key(K_QUALITY);  e.num(qualityFromRSSI(nets[i].rssi));
+    e.key(K_CHANNEL);  e.num(nets[i].ch);
+    e.key(K_SECURITY); e.str(encTypeToStr(nets[i].enc));
+    e.endObj();
+  }
+  e.endArr();
+}
+
+void scanCacheRebuild(){
+  FixedSink fs = {(uint8_t*)scanJson, SCAN_JSON_MAX - 1, 0};
+  Emitter e(false, fixedSink, &fs);
+  emitScan(e, SCAN_JSON_MAX - 1);
+  e.flush();
+  scanJsonLen = fs.len; scanJson[scanJsonLen] = 0;
+  snprintf(scanEtag, sizeof(scanEtag), "\"%08x\"", (unsigned)crc32((const uint8_t*)scanJson, scanJsonLen));
+  scanGzLen = gzipTo((const uint8_t*)scanJson, scanJsonLen, scanGz, SCAN_GZ_MAX);
+}
+
+// ====== Detección de APs suplantadores ======
+// Cada escaneo se compara con un conjunto de huellas (SSID, BSSID, seguridad) indexado por el hash del
+// SSID: cada resultado cuesta un par de sondeos en tablas fijas, O(resultados) por escaneo.
+// Alertas (log + tarjeta en /admin, ver /api/alerts):
+// - "impostor": un BSSID nuevo anuncia ap_ssid (siempre) o un SSID de PROTECTED_SSIDS que ya pasó su
+//   línea base (los BSSIDs vistos en los primeros ROGUE_LEARN_SCANS escaneos son los legítimos).
+// - "security_change": un BSSID conocido cambia de modo de seguridad (p.ej. WPA2 -> Abierta).
+// - "downgrade": un BSSID nuevo anuncia un SSID conocido con seguridad más débil que la de la red.
+// Con la tabla llena, la huella nueva reemplaza en su lugar a la vista hace más tiempo (LRU), salvo las
+// legítimas de los SSIDs protegidos: cada BSSID nuevo queda registrado y alerta una sola vez.
+static const int ROGUE_MAX_APS   = 192;
+static const int ROGUE_MAX_SSIDS = 96;
+static const int ROGUE_SLOTS     = 256;         // potencia de 2, > capacidad de cada tabla
+static const uint16_t ROGUE_LEARN_SCANS = 3;
+static const int MAX_ROGUE_ALERTS = 16;
+
+enum SsidGuard : uint8_t { GUARD_NONE, GUARD_LISTED, GUARD_OWN };
+enum RogueKind : uint8_t { ROGUE_IMPOSTOR, ROGUE_SECURITY_CHANGE, ROGUE_DOWNGRADE };
+static const char* const ROGUE_KIND_NAMES[] = {"impostor", "security_change", "downgrade"};
+
+struct ApPrint   { uint64_t bssid; uint32_t ssid; uint16_t seen; uint8_t auth; bool good; };
+struct SsidPrint { uint32_t ssid; uint16_t seen; uint8_t best; SsidGuard guard; };
+struct RogueState {
+  FixedVec<ApPrint, ROGUE_MAX_APS> aps;
+  FixedVec<SsidPrint, ROGUE_MAX_SSIDS> ssids;
+  uint8_t apIdx[ROGUE_SLOTS], ssidIdx[ROGUE_SLOTS];  // posición en el vector + 1; 0 = libre
+  uint32_t scans;   // escaneos con resultados; las huellas guardan los 16 bits bajos
+};
+RogueState rogue = {};
+
+struct RogueAlert {
+  uint32_t timestamp;
+  RogueKind kind;
+  uint8_t auth, prevAuth;  // prevAuth = 0xFF: no aplica
+  uint8_t ch;
+  int8_t rssi;
+  uint8_t bssid[6];
+  SsidStr ssid;
+};
+FixedRing<RogueAlert, MAX_ROGUE_ALERTS> rogueAlerts;
+
+uint32_t ssidHash(const char* s){ // FNV-1a
+  uint32_t h = 2166136261u;
+  while (*s){ h ^= (uint8_t)*s++; h *= 16777619u; }
+  return h ? h : 1;
+}
+inline uint32_t rogueSlot(uint64_t k){ return (uint32_t)((k * 0x9E3779B97F4A7C15ULL) >> 56) & (ROGUE_SLOTS-1); }
+inline uint64_t apKey(uint32_t ssid, uint64_t bssid){ return ((uint64_t)ssid << 16) ^ bssid; }
+
+// Orden de fortaleza; los modos desconocidos se tratan como los más fuertes (no generan "downgrade")
+uint8_t secRank(uint8_t a){
+  switch (a){
+    case WIFI_AUTH_OPEN:           return 0;
+    case WIFI_AUTH_WEP:            return 1;
+    case WIFI_AUTH_WPA_PSK:        return 2;
+    case WIFI_AUTH_WPA_WPA2_PSK:   return 3;
+    case WIFI_AUTH_WPA2_PSK:       return 4;
+    case WIFI_AUTH_WPA2_ENTERPRISE:return 5;
+    default:                       return 6;
+  }
+}
+
+ApPrint* apFind(uint32_t ssid, uint64_t bssid){
+  for (uint32_t s = rogueSlot(apKey(ssid, bssid)); rogue.apIdx[s]; s = (s+1) & (ROGUE_SLOTS-1)){
+    ApPrint& p = rogue.aps[rogue.apIdx[s] - 1];
+    if (p.ssid == ssid && p.bssid == bssid) return &p;
+  }
+  return nullptr;
+}
+SsidPrint* ssidFind(uint32_t ssid){
+  for (uint32_t s = rogueSlot(ssid); rogue.ssidIdx[s]; s = (s+1) & (ROGUE_SLOTS-1)){
+    SsidPrint& p = rogue.ssids[rogue.ssidIdx[s] - 1];
+    if (p.ssid == ssid) return &p;
+  }
+  return nullptr;
+}
+void indexPut(uint8_t* idx, uint64_t key, size_t pos){
+  uint32_t s = rogueSlot(key);
+  while (idx[s]) s = (s+1) & (ROGUE_SLOTS-1);
+  idx[s] = pos + 1;
+}
+// Quita la posición 'pos' del índice corriendo hacia atrás la cadena de sondeo (sin lápidas)
+template<typename KeyOf> void indexDel(uint8_t* idx, uint64_t key, size_t pos, KeyOf keyOf){
+  const uint32_t M = ROGUE_SLOTS - 1;
+  uint32_t hole = rogueSlot(key);
+  while (idx[hole] != pos + 1) hole = (hole+1) & M;
+  for (uint32_t j = (hole+1) & M; idx[j]; j = (j+1) & M){
+    uint32_t home = rogueSlot(keyOf(idx[j] - 1));
+    if (((j - home) & M) >= ((j - hole) & M)){ idx[hole] = idx[j]; hole = j; }
+  }
+  idx[hole] = 0;
+}
+// Con la tabla llena: desindexa la entrada vista hace más tiempo que se pueda olvidar y devuelve su
+// posición para reutilizarla en el lugar (-1 si todas son legítimas/vigiladas)
+int apEvict(){
+  uint16_t now = rogue.scans;
+  int lru = -1;
+  for (size_t i=0;i<rogue.aps.size();i++){
+    const ApPrint& p = rogue.aps[i];
+    if (!p.good && (lru < 0 || (uint16_t)(now - p.seen) > (uint16_t)(now - rogue.aps[lru].seen))) lru = i;
+  }
+  if (lru >= 0) indexDel(rogue.apIdx, apKey(rogue.aps[lru].ssid, rogue.aps[lru].bssid), lru,
+                         [](size_t i){ return apKey(rogue.aps[i].ssid, rogue.aps[i].bssid); });
+  return lru;
+}
+int ssidEvict(){
+  uint16_t now = rogue.scans;
+  int lru = -1;
+  for (size_t i=0;i<rogue.ssids.size();i++){
+    const SsidPrint& p = rogue.ssids[i];
+    if (!p.guard && (lru < 0 || (uint16_t)(now - p.seen) > (uint16_t)(now - rogue.ssids[lru].seen))) lru = i;
+  }
+  if (lru >= 0) indexDel(rogue.ssidIdx, rogue.ssids[lru].ssid, lru, [](size_t i){ return (uint64_t)rogue.ssids[i].ssid; });
+  return lru;
+}
+
+// Los SSIDs vigilados se cargan al arrancar y nunca se olvidan
+void rogueGuard(const char* name, SsidGuard g, uint8_t best){
+  uint32_t h = ssidHash(name);
+  if (!*name || ssidFind(h) || rogue.ssids.full()) return;
+  rogue.ssids.push({h, 0, best, g});
+  indexPut(rogue.ssidIdx, h, rogue.ssids.size() - 1);
+}
+void rogueInit(){
+  rogueGuard(ap_ssid.c_str(), GUARD_OWN, WIFI_AUTH_WPA2_PSK);
+  for (const char* p : PROTECTED_SSIDS) rogueGuard(p, GUARD_LISTED, WIFI_AUTH_OPEN);
+}
+
+void rogueAlert(RogueKind kind, const wifi_ap_record_t* ap, uint8_t prevAuth){
+  RogueAlert& a = rogueAlerts.push();
+  a.timestamp = millis();
+  a.kind = kind;
+  a.auth = ap->authmode; a.prevAuth = prevAuth;
+  a.ch = ap->primary; a.rssi = ap->rssi;
+  memcpy(a.bssid, ap->bssid, 6);
+  a.ssid.assign((const char*)ap->ssid);
+  metrics.rogueAlerts++;
+  MacStr m = macFromBytes(ap->bssid);
+  const char* sec = encTypeToStr(ap->authmode);
+  if (kind == ROGUE_IMPOSTOR)
+    logEventf("ALERTA: posible AP suplantador de '%s': %s (%s, canal %d, %s).", a.ssid.c_str(), m.c_str(), macVendor(m.c_str()), a.ch, sec);
+  else if (kind == ROGUE_SECURITY_CHANGE)
+    logEventf("ALERTA: '%s' (%s) cambió de seguridad: %s -> %s.", a.ssid.c_str(), m.c_str(), encTypeToStr((wifi_auth_mode_t)prevAuth), sec);
+  else
+    logEventf("ALERTA: nuevo BSSID %s para '%s' con seguridad %s (la red usa %s).", m.c_str(), a.ssid.c_str(), sec, encTypeToStr((wifi_auth_mode_t)prevAuth));
+}
+
+// Un resultado del escaneo. Llamar rogueScanDone() al terminar cada escaneo con resultados.
+void rogueCheck(const wifi_ap_record_t* ap){
+  const char* name = (const char*)ap->ssid;
+  if (!*name) return; // oculta: no puede suplantar por nombre
+  uint32_t h = ssidHash(name);
+  uint64_t b = macToU64(ap->bssid);
+  uint8_t auth = ap->authmode;
+  bool learning = rogue.scans < ROGUE_LEARN_SCANS;
+
+  SsidPrint* s = ssidFind(h);
+  if (!s){
+    int pos = rogue.ssids.size();
+    if (rogue.ssids.full()) pos = ssidEvict(); else rogue.ssids.push({});
+    if (pos < 0) return;
+    rogue.ssids[pos] = {h, (uint16_t)rogue.scans, auth, GUARD_NONE};
+    indexPut(rogue.ssidIdx, h, pos);
+    s = &rogue.ssids[pos];
+  }
+  s->seen = rogue.scans;
+
+  if (ApPrint* p = apFind(h, b)){
+    if (p->auth != auth && !learning) rogueAlert(ROGUE_SECURITY_CHANGE, ap, p->auth);
+    p->auth = auth; p->seen = rogue.scans;
+  } else {
+    bool good = s->guard == GUARD_LISTED && learning;
+    if (s->guard == GUARD_OWN || (s->guard == GUARD_LISTED && !learning)) rogueAlert(ROGUE_IMPOSTOR, ap, 0xFF);
+    else if (!learning && secRank(auth) < secRank(s->best)) rogueAlert(ROGUE_DOWNGRADE, ap, s->best);
+    int pos = rogue.aps.size();
+    if (rogue.aps.full()) pos = apEvict(); else rogue.aps.push({});
+    if (pos >= 0){
+      rogue.aps[pos] = {b, h, (uint16_t)rogue.scans, auth, good};
+      indexPut(rogue.apIdx, apKey(h, b), pos);
+    }
+  }
+  if (secRank(auth) > secRank(s->best)) s->best = auth;
+}
+void rogueScanDone(){ rogue.scans++; }
+
+// ====== Scanner core ======
+// El escaneo es asíncrono: runScan() sólo lo lanza y scanPoll() recoge los resultados cuando el driver
+// termina (2-3 s en los que loop() sigue atendiendo HTTP y DNS). scanCollect() es la única parte que
+// ocupa el loop y es lo que mide metrics.scan; la duración completa queda en metrics.scanLastMs.
+static const uint32_t SCAN_POLL_MS    = 100;
+static const uint32_t SCAN_TIMEOUT_MS = 10000;
+bool scanRunning = false;
+uint32_t scanStartMs = 0;
+
+void scanDone(uint32_t t0){
+  scanRunning = false;
+  metrics.scanLastMs = millis() - scanStartMs;
+  histObserve(metrics.scan, micros() - t0);
+  bootMark(BOOT_FIRST_SCAN);
+}
+void scanCollect(int n){
+  TRACE_SCOPE(TR_RUN_SCAN);
+  uint32_t t0 = micros();
+  nets.clear();
+  if (n <= 0){ WiFi.scanDelete(); scanCacheRebuild(); scanDone(t0); return; }
+
+  // Suplantadores: sobre todos los resultados, no sólo los MAX_NETS que se muestran
+  for (int i=0;i<n;i++){
+    const wifi_ap_record_t* ap = (const wifi_ap_record_t*)WiFi.getScanInfoByIndex(i);
+    if (ap) rogueCheck(ap);
+  }
+  rogueScanDone();
+
+  // Selección de las MAX_NETS más fuertes por inserción ordenada (sin memoria dinámica)
+  static int order[MAX_NETS];
+  int take = 0;
+  for (int i=0;i<n;i++){
+    int32_t r = WiFi.RSSI(i);
+    int pos = take;
+    while (pos > 0 && WiFi.RSSI(order[pos-1]) < r) pos--;
+    if (pos >= MAX_NETS) continue;
+    int last = (take < MAX_NETS) ? take : MAX_NETS - 1;
+    for (int k=last;k>pos;k--) order[k] = order[k-1];
+    order[pos] = i;
+    if (take < MAX_NETS) take++;
   }
-  int take = (n < MAX_NETS ? n : MAX_NETS);
   for (int k=0;k<take;k++){
-    int i = idx[k];
-    nets[k].ssid = WiFi.SSID(i);
-    if (nets[k].ssid.length()==0) nets[k].ssid = "<oculta>";
-    nets[k].bssid = macToStr(WiFi.BSSID(i));
-    nets[k].rssi  = WiFi.RSSI(i);
-    nets[k].ch    = WiFi.channel(i);
-    nets[k].enc   = WiFi.encryptionType(i);
-  }
-  netCount = take;
-  free(idx);
+    const wifi_ap_record_t* ap = (const wifi_ap_record_t*)WiFi.getScanInfoByIndex(order[k]);
+    if (!ap) continue;
+    NetRes r;
+    r.ssid.assign((const char*)ap->ssid);
+    if (r.ssid.empty()) r.ssid = "<oculta>";
+    r.bssid = macFromBytes(ap->bssid);
+    r.rssi  = ap->rssi;
+    r.ch    = ap->primary;
+    r.enc   = ap->authmode;
+    nets.push(r);
+  }
+  metrics.scanResults += n;
   WiFi.scanDelete();
+  scanCacheRebuild();
+  scanDone(t0);
+}
+
+void scanPoll(){
+  int n = WiFi.scanComplete();
+  if (n == WIFI_SCAN_RUNNING && millis() - scanStartMs < SCAN_TIMEOUT_MS){
+    schedOnce("scan_poll", scanPoll, SCAN_POLL_MS, 2000, 2);
+    return;
+  }
+  scanCollect(n); // fallo o timeout: tabla vacía, como con el escaneo bloqueante
+}
+void runScan(){
+  if (scanRunning && millis() - scanStartMs < SCAN_TIMEOUT_MS) return; // ya hay uno en curso
+  metrics.scans++;
+  scanRunning = true;
+  scanStartMs = millis();
+  if (WiFi.scanNetworks(true, true) == WIFI_SCAN_FAILED){ scanCollect(WIFI_SCAN_FAILED); return; } // async + hidden
+  schedOnce("scan_poll", scanPoll, SCAN_POLL_MS, 2000, 2);
 }
 
 // ====== Listas (NVS) ======
-bool macInList(const String& mac, String* list, int count){
+bool macInList(const char* mac, const MacStr* list, int count){
   for(int i=0;i<count;i++) if (list[i]==mac) return true;
   return false;
 }
-bool macAllowed(const String& mac){ return macInList(mac, allowList, allowCount); }
-bool macBlocked(const String& mac){ return macInList(mac, blackList, blackCount); }
-bool addToList(const String& mac, String* list, int &count){
-  if (count>=MAX_MACS) return false;
-  if (macInList(mac, list, count)) return true;
-  list[count++] = mac;
-  return true;
+bool macInList(const char* mac, const MacList& list){ return macInList(mac, list.data(), list.size()); }
+
+// ====== Índice de reglas (ACL) ======
+// Las listas guardan reglas canónicas (MAC o prefijo, ver normalizeRule). Se compilan a una tabla hash
+// de direccionamiento abierto con clave (longitud, prefijo); decidir cuesta a lo sumo un sondeo por
+// longitud (48, 36, 28, 24), sin importar cuántas reglas haya.
+// Precedencia: gana la regla más específica; a igual longitud, la lista negra prevalece.
+// Así "AA:BB:CC/24" en la blanca con "AA:BB:CC:11:22:33" en la negra bloquea sólo esa estación.
+enum AclVerdict : uint8_t { ACL_NONE = 0, ACL_ALLOW = 1, ACL_BLACK = 2 };
+static const int ACL_SLOTS = 512; // potencia de 2, >= 2x las reglas posibles (2*MAX_MACS)
+static const uint8_t ACL_LENS[] = {48, 36, 28, 24};
+// Dos tablas: se arma la que no está publicada y se publica con un único store de puntero, así
+// aclDecide() (loop o tarea de eventos) nunca sondea una tabla a medio armar. aclMux sólo serializa a
+// quién le toca armar; si otra tarea ya está en eso, se sigue decidiendo con la publicada.
+struct AclTable {
+  uint64_t keys[ACL_SLOTS];       // 0 = libre; clave = len<<48 | prefijo
+  uint8_t  bits[ACL_SLOTS];
+  uint8_t  lenMask;               // bit i: hay reglas de longitud ACL_LENS[i]
+};
+AclTable aclTables[2];
+AclTable* volatile aclLive = &aclTables[0];
+volatile bool aclDirty = true;  // se marca después de cambiar la lista y se limpia antes de reconstruir
+portMUX_TYPE aclMux = portMUX_INITIALIZER_UNLOCKED;
+bool aclBuilding = false;
+
+inline uint32_t aclSlot(uint64_t key){ return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 55) & (ACL_SLOTS-1); }
+inline uint64_t aclKey(uint64_t mac, uint8_t len){
+  return ((uint64_t)len << 48) | (mac & (0xFFFFFFFFFFFFULL << (48-len)) & 0xFFFFFFFFFFFFULL);
+}
+void aclInsert(AclTable& t, const MacStr& rule, uint8_t bit){
+  int digits; uint64_t v = macStrToU64(rule.c_str(), &digits);
+  const char* sl = strchr(rule.c_str(), '/');
+  uint8_t len = sl ? (uint8_t)atoi(sl+1) : 48;
+  if (len/4 != digits) return; // entrada corrupta en NVS
+  for (int i=0;i<4;i++) if (ACL_LENS[i]==len) t.lenMask |= 1<<i;
+  uint64_t key = aclKey(v, len);
+  for (uint32_t s = aclSlot(key);; s = (s+1) & (ACL_SLOTS-1)){
+    if (t.keys[s] == 0){ t.keys[s] = key; t.bits[s] = bit; return; }
+    if (t.keys[s] == key){ t.bits[s] |= bit; return; }
+  }
+}
+void aclRebuild(){
+  portENTER_CRITICAL(&aclMux);
+  bool busy = aclBuilding;
+  if (!busy){ aclBuilding = true; aclDirty = false; } // un cambio durante la reconstrucción la vuelve a marcar
+  portEXIT_CRITICAL(&aclMux);
+  if (busy) return;
+  AclTable& t = aclLive == &aclTables[0] ? aclTables[1] : aclTables[0];
+  memset(t.keys, 0, sizeof(t.keys));
+  t.lenMask = 0;
+  for (const MacStr& r : allowList) aclInsert(t, r, ACL_ALLOW);
+  for (const MacStr& r : blackList) aclInsert(t, r, ACL_BLACK);
+  aclLive = &t;
+  portENTER_CRITICAL(&aclMux);
+  aclBuilding = false;
+  portEXIT_CRITICAL(&aclMux);
 }
-bool delFromList(const String& mac, String* list, int &count){
-  for (int i=0;i<count;i++){
-    if (list[i]==mac){
-      for (int j=i+1;j<count;j++) list[j-1]=list[j];
-      count--; return true;
+AclVerdict aclDecide(uint64_t mac){
+  if (aclDirty) aclRebuild();
+  const AclTable& t = *aclLive;
+  for (int i=0;i<4;i++){
+    if (!(t.lenMask & (1<<i))) continue;
+    uint64_t key = aclKey(mac, ACL_LENS[i]);
+    for (uint32_t s = aclSlot(key); t.keys[s]; s = (s+1) & (ACL_SLOTS-1)){
+      if (t.keys[s] == key) return (t.bits[s] & ACL_BLACK) ? ACL_BLACK : ACL_ALLOW;
     }
   }
+  return ACL_NONE;
+}
+bool macAllowed(const char* mac){ return aclDecide(macStrToU64(mac)) == ACL_ALLOW; }
+bool macBlocked(const char* mac){ return aclDecide(macStrToU64(mac)) == ACL_BLACK; }
+
+bool addToList(const char* mac, MacList& list){
+  if (macInList(mac, list)) return true;
+  bool ok = list.push(MacStr(mac));
+  aclDirty = true; // después del cambio: aclDecide() puede correr en medio desde la tarea de eventos
+  viewTouch(&list == &allowList ? L_ALLOW : L_BLACK);
+  return ok;
+}
+bool delFromList(const char* mac, MacList& list){
+  for (size_t i=0;i<list.size();i++){
+    if (list[i]==mac){ list.erase(i); aclDirty = true; viewTouch(&list == &allowList ? L_ALLOW : L_BLACK); return true; }
+  }
   return false;
 }
-bool addMacAllow(const String& mac){ return addToList(mac, allowList, allowCount); }
-bool delMacAllow(const String& mac){ return delFromList(mac, allowList, allowCount); }
-bool addMacBlack(const String& mac){ return addToList(mac, blackList, blackCount); }
-bool delMacBlack(const String& mac){ return delFromList(mac, blackList, blackCount); }
+bool addMacAllow(const char* mac){ return addToList(mac, allowList); }
+bool delMacAllow(const char* mac){ return delFromList(mac, allowList); }
+bool addMacBlack(const char* mac){ return addToList(mac, blackList); }
+bool delMacBlack(const char* mac){ return delFromList(mac, blackList); }
 
-String serializeList(String* list, int count){
+String serializeList(const MacList& list){
   String csv;
-  for (int i=0;i<count;i++){ if(i) csv+=','; csv+=list[i]; }
+  for (size_t i=0;i<list.size();i++){ if(i) csv+=','; csv+=list[i]; }
   return csv;
 }
-void deserializeList(const String& csv, String* list, int &count){
-  count=0;
+void deserializeList(const String& csv, MacList& list){
+  list.clear();
   int start=0;
   while (start < (int)csv.length()){
     int idx = csv.indexOf(',', start);
     String item = (idx==-1)? csv.substring(start) : csv.substring(start,idx);
     item.trim();
-    if (item.length() && count<MAX_MACS) list[count++]=item;
+    if (item.length()) list.push(MacStr(item));
     if (idx==-1) break; start = idx+1;
   }
+  aclDirty = true;
+  viewTouch(&list == &allowList ? L_ALLOW : L_BLACK);
 }
 void loadListsFromNVS(){
+  TRACE_SCOPE(TR_NVS_READ);
   prefs.begin("maclist", true);
   String csvA = prefs.getString("allow", "");
   String csvB = prefs.getString("black", "");
   prefs.end();
-  deserializeList(csvA, allowList, allowCount);
-  deserializeList(csvB, blackList, blackCount);
+  metrics.nvsReads += 2;
+  deserializeList(csvA, allowList);
+  deserializeList(csvB, blackList);
 }
 void saveAllowToNVS(){
-  String csv = serializeList(allowList, allowCount);
+  TRACE_SCOPE(TR_NVS_WRITE);
+  String csv = serializeList(allowList);
   prefs.begin("maclist", false);
   prefs.putString("allow", csv);
   prefs.end();
+  metrics.nvsWrites++;
 }
 void saveBlackToNVS(){
-  String csv = serializeList(blackList, blackCount);
+  TRACE_SCOPE(TR_NVS_WRITE);
+  String csv = serializeList(blackList);
   prefs.begin("maclist", false);
   prefs.putString("black", csv);
   prefs.end();
+  metrics.nvsWrites++;
+}
+
+// Las claves NVS admiten como mucho 15 caracteres: se usa la MAC sin ':' (12 hex)
+void aliasKey(const char* mac, char* key){ // key: 13 bytes
+  int k = 0;
+  for (const char* p = mac; *p && k < 12; ++p) if (*p != ':') key[k++] = *p;
+  key[k] = 0;
 }
 
-void saveAliasToNVS(const String& mac, const String& alias){
+void saveAliasToNVS(const char* mac, const String& alias){
+  TRACE_SCOPE(TR_NVS_WRITE);
+  char key[13]; aliasKey(mac, key);
+  AliasStr a(alias);
   aliasPrefs.begin("mac_alias", false);
-  aliasPrefs.putString(mac.c_str(), alias);
+  aliasPrefs.putString(key, a.c_str());
   aliasPrefs.end();
+  metrics.nvsWrites++;
 }
 
-String getAliasFromNVS(const String& mac){
+void getAliasFromNVS(const char* mac, AliasStr& out){
+  TRACE_SCOPE(TR_NVS_READ);
+  char key[13]; aliasKey(mac, key);
+  out.clear();
   aliasPrefs.begin("mac_alias", true);
-  String alias = aliasPrefs.getString(mac.c_str(), "");
+  if (aliasPrefs.getString(key, out.buf, sizeof(out.buf)) > 0) out.len = strlen(out.buf);
+  else out.clear();
   aliasPrefs.end();
-  return alias;
+  metrics.nvsReads++;
 }
 
-void deleteAliasFromNVS(const String& mac){
+void deleteAliasFromNVS(const char* mac){
+  TRACE_SCOPE(TR_NVS_WRITE);
+  char key[13]; aliasKey(mac, key);
   aliasPrefs.begin("mac_alias", false);
-  aliasPrefs.remove(mac.c_str());
+  aliasPrefs.remove(key);
   aliasPrefs.end();
+  metrics.nvsWrites++;
+}
+
+// La config del AP es un único blob binario: una sola lectura de NVS en el camino crítico del arranque.
+// Si falta (versiones anteriores guardaban "ssid" y "pass" como texto) se migra una vez.
+static const uint8_t AP_CFG_VERSION = 1;
+struct APConfigBlob {
+  uint8_t version;
+  char ssid[33];
+  char pass[65];
+};
+
+void saveAPConfigToNVS(const String& ssid, const String& pass) {
+  TRACE_SCOPE(TR_NVS_WRITE);
+  APConfigBlob b = {};
+  b.version = AP_CFG_VERSION;
+  snprintf(b.ssid, sizeof(b.ssid), "%s", ssid.c_str());
+  snprintf(b.pass, sizeof(b.pass), "%s", pass.c_str());
+  apConfig.begin("ap_config", false);
+  apConfig.putBytes("cfg", &b, sizeof(b));
+  apConfig.end();
+  metrics.nvsWrites++;
 }
 
 void loadAPConfigFromNVS() {
+  TRACE_SCOPE(TR_NVS_READ);
+  APConfigBlob b;
   apConfig.begin("ap_config", true);
-  ap_ssid = apConfig.getString("ssid", DEFAULT_AP_SSID);
-  ap_pass = apConfig.getString("pass", DEFAULT_AP_PASS);
+  bool ok = apConfig.getBytes("cfg", &b, sizeof(b)) == sizeof(b) && b.version == AP_CFG_VERSION;
+  metrics.nvsReads++;
+  if (!ok){
+    ap_ssid = apConfig.getString("ssid", DEFAULT_AP_SSID);
+    ap_pass = apConfig.getString("pass", DEFAULT_AP_PASS);
+    metrics.nvsReads += 2;
+  }
   apConfig.end();
+  if (!ok){ saveAPConfigToNVS(ap_ssid, ap_pass); return; }
+  b.ssid[sizeof(b.ssid) - 1] = b.pass[sizeof(b.pass) - 1] = 0;
+  ap_ssid = b.ssid;
+  ap_pass = b.pass;
 }
 
-void saveAPConfigToNVS(const String& ssid, const String& pass) {
-  apConfig.begin("ap_config", false);
-  apConfig.putString("ssid", ssid);
-  apConfig.putString("pass", pass);
-  apConfig.end();
+// ====== Historial por cliente ======
+// Por MAC: sesiones (inicio/fin), reconexiones y una serie de RSSI con tres resoluciones en anillos fijos:
+// 1 s (último minuto), 1 min (última hora) y 1 h (último día). Cada muestra entra al segundo y además se
+// acumula en el minuto y la hora abiertos; al cambiar de minuto/hora la cubeta se cierra y los huecos
+// quedan como cubetas vacías. Con MAX_HISTORY clientes (reemplazo LRU) la memoria es fija (~10 KB).
+// El tiempo es el uptime en segundos (esp_timer, 64 bits): no da la vuelta como millis() a los 49 días.
+static const int MAX_HISTORY = 24;
+static const int HIST_SESSIONS = 8;
+static const uint32_t QUICK_RECONNECT_S = 60; // reconexión "rápida": roaming o enlace inestable
+
+struct RssiBucket { int8_t min, avg, max; };  // todo 0 = sin muestras
+struct RssiAcc {
+  int32_t sum; int8_t min, max; uint16_t n;
+  void add(int v){ if (!n || v < min) min = v; if (!n || v > max) max = v; sum += v; n++; }
+  RssiBucket take(){ RssiBucket b = {0, 0, 0}; if (n) b = {min, (int8_t)(sum / n), max}; *this = {}; return b; }
+};
+struct Session { uint32_t startS, endS; };      // endS == 0: abierta
+
+struct ClientHistory {
+  uint64_t mac;
+  uint32_t firstS, lastS;
+  uint16_t connects, quickReconnects;
+  FixedRing<Session, HIST_SESSIONS> sessions;
+  FixedRing<int8_t, 60> secs;     uint32_t secT;   // secT: segundo de la muestra más nueva
+  FixedRing<RssiBucket, 60> mins; uint32_t minT;  RssiAcc minAcc;  // minT: minuto abierto
+  FixedRing<RssiBucket, 24> hours; uint32_t hourT; RssiAcc hourAcc;
+};
+FixedVec<ClientHistory, MAX_HISTORY> history;
+
+uint32_t uptimeS(){ return (uint32_t)(esp_timer_get_time() / 1000000); }
+
+// Agrega cubetas vacías hasta llegar a t (a lo sumo un anillo completo)
+template<typename T, size_t N> void ringAdvance(FixedRing<T, N>& r, uint32_t& cur, uint32_t t){
+  if (t <= cur) return;
+  uint32_t gap = t - cur; if (gap > N) gap = N;
+  for (uint32_t i=0;i<gap;i++) r.push() = T{};
+  cur = t;
+}
+// Cierra el minuto y la hora abiertos si ya pasaron
+void histAdvance(ClientHistory& h, uint32_t nowS){
+  uint32_t m = nowS / 60, hr = nowS / 3600;
+  if (m != h.minT){ h.mins.push() = h.minAcc.take(); h.minT++; ringAdvance(h.mins, h.minT, m); h.minT = m; }
+  if (hr != h.hourT){ h.hours.push() = h.hourAcc.take(); h.hourT++; ringAdvance(h.hours, h.hourT, hr); h.hourT = hr; }
+  ringAdvance(h.secs, h.secT, nowS);
+}
+ClientHistory* histFind(uint64_t mac){
+  for (ClientHistory& h : history) if (h.mac == mac) return &h;
+  return nullptr;
+}
+ClientHistory& histGet(uint64_t mac, uint32_t nowS){
+  ClientHistory* h = histFind(mac);
+  if (h){ histAdvance(*h, nowS); return *h; }
+  if (!history.full()){ history.push(ClientHistory()); h = &history[history.size() - 1]; }
+  else {
+    h = &history[0];
+    for (ClientHistory& x : history) if (x.lastS < h->lastS) h = &x;
+  }
+  *h = ClientHistory();
+  h->mac = mac; h->firstS = h->lastS = nowS;
+  h->secT = nowS; h->minT = nowS / 60; h->hourT = nowS / 3600;
+  return *h;
+}
+
+void histConnect(uint64_t mac){
+  uint32_t now = uptimeS();
+  ClientHistory& h = histGet(mac, now);
+  if (h.sessions.size()){
+    Session& last = h.sessions.last();
+    if (!last.endS) last.endS = now;           // se perdió el evento de desconexión
+    else if (now - last.endS <= QUICK_RECONNECT_S) h.quickReconnects++;
+  }
+  h.sessions.push() = {now, 0};
+  h.connects++;
+  h.lastS = now;
+}
+void histDisconnect(uint64_t mac){
+  ClientHistory* h = histFind(mac);
+  if (!h || !h->sessions.size()) return;
+  uint32_t now = uptimeS();
+  histAdvance(*h, now);
+  Session& last = h->sessions.last();
+  if (!last.endS) last.endS = now;
+  h->lastS = now;
+}
+void histRssi(uint64_t mac, int rssi){
+  if (!rssi) return;
+  uint32_t now = uptimeS();
+  ClientHistory& h = histGet(mac, now);
+  if (h.secs.size() && h.secT == now) h.secs.last() = rssi;
+  else { ringAdvance(h.secs, h.secT, now - 1); h.secs.push() = rssi; h.secT = now; }
+  h.minAcc.add(rssi);
+  h.hourAcc.add(rssi);
+  h.lastS = now;
 }
 
 // ====== Conectados/Pendientes ======
-int findConnectedIdx(const String& mac){
-  for(int i=0;i<connectedCount;i++) if (connected[i].mac==mac) return i;
+int findConnectedIdx(const char* mac){
+  for(size_t i=0;i<connected.size();i++) if (connected[i].mac==mac) return i;
   return -1;
 }
-void addOrUpdateConnected(const String& mac, uint16_t aid){
+// Las vistas se marcan sólo al insertar o quitar filas; refrescar lastSeenMs reubica la fila en el orden
+// por antigüedad (viewSeen) sin reconstruir los índices.
+void addOrUpdateConnected(const char* mac, uint16_t aid){
   int idx = findConnectedIdx(mac);
-  if (idx>=0){ connected[idx].lastSeenMs = millis(); connected[idx].aid = aid; return; }
-  if (connectedCount<MAX_CONNECTED){
-    connected[connectedCount++] = {mac, getAliasFromNVS(mac), millis(), aid, 0};
-  }
+  if (idx>=0){ connected[idx].lastSeenMs = millis(); connected[idx].aid = aid; viewSeen(L_CONNECTED, idx); return; }
+  if (connected.full()) return;
+  Device d = {mac, "", millis(), aid, 0};
+  getAliasFromNVS(mac, d.alias);
+  connected.push(d);
+  viewTouch(L_CONNECTED);
 }
-void removeConnected(const String& mac){
+void removeConnected(const char* mac){
   int idx = findConnectedIdx(mac);
-  if (idx<0) return;
-  for (int j=idx+1;j<connectedCount;j++) connected[j-1]=connected[j];
-  connectedCount--;
+  if (idx>=0){ connected.erase(idx); viewTouch(L_CONNECTED); }
 }
-int findPendingIdx(const String& mac){
-  for(int i=0;i<pendingCount;i++) if (pending[i].mac==mac) return i;
+int findPendingIdx(const char* mac){
+  for(size_t i=0;i<pending.size();i++) if (pending[i].mac==mac) return i;
   return -1;
 }
 bool isNewPending = false;
-void addOrUpdatePending(const String& mac, uint16_t aid){
+void addOrUpdatePending(const char* mac, uint16_t aid){
   int idx = findPendingIdx(mac);
-  if (idx>=0){ pending[idx].lastSeenMs = millis(); pending[idx].aid = aid; return; }
+  if (idx>=0){ pending[idx].lastSeenMs = millis(); pending[idx].aid = aid; viewSeen(L_PENDING, idx); return; }
+  viewTouch(L_PENDING);
   
   // Set flag for new pending device
   isNewPending = true;
 
-  if (pendingCount<MAX_PENDING){
-    pending[pendingCount++] = {mac, getAliasFromNVS(mac), millis(), aid, 0};
+  Device d = {mac, "", millis(), aid, 0};
+  getAliasFromNVS(mac, d.alias);
+  if (!pending.full()){
+    pending.push(d);
   } else {
     int oldest=0; uint32_t t=pending[0].lastSeenMs;
-    for(int i=1;i<pendingCount;i++) if (pending[i].lastSeenMs<t){ oldest=i; t=pending[i].lastSeenMs; }
-    pending[oldest] = {mac, getAliasFromNVS(mac), millis(), aid, 0};
+    for(size_t i=1;i<pending.size();i++) if (pending[i].lastSeenMs<t){ oldest=i; t=pending[i].lastSeenMs; }
+    pending[oldest] = d;
   }
 }
+void removePending(const char* mac){
+  int idx = findPendingIdx(mac);
+  if (idx>=0){ pending.erase(idx); viewTouch(L_PENDING); }
+}
 void prunePending(){
+  TRACE_SCOPE(TR_PRUNE);
   uint32_t now = millis();
-  int w=0;
-  for (int i=0;i<pendingCount;i++){
-    if (now - pending[i].lastSeenMs <= PENDING_TTL_MS){
-      if (w!=i) pending[w]=pending[i];
-      w++;
-    }
-  }
-  pendingCount = w;
+  size_t before = pending.size();
+  pending.removeIf([now](const Device& d){ return now - d.lastSeenMs > PENDING_TTL_MS; });
+  if (pending.size() != before) viewTouch(L_PENDING);
 }
 void refreshRSSIConnected(){
+  TRACE_SCOPE(TR_RSSI);
   wifi_sta_list_t sta_list;
   if (esp_wifi_ap_get_sta_list(&sta_list) != ESP_OK) return;
-  for (int i=0;i<connectedCount;i++) connected[i].rssi = 0;
+  // La vista sólo se marca si alguna señal cambió: con el AP quieto no se reordena nada
+  int8_t fresh[MAX_CONNECTED] = {};
   for (int i=0;i<sta_list.num; i++){
     const wifi_sta_info_t &st = sta_list.sta[i];
-    String m = macToStr(st.mac);
-    int idx = findConnectedIdx(m);
-    if (idx >= 0) connected[idx].rssi = st.rssi;
+    MacStr m = macFromBytes(st.mac);
+    int idx = findConnectedIdx(m.c_str());
+    if (idx >= 0){ fresh[idx] = st.rssi; histRssi(macToU64(st.mac), st.rssi); }
+  }
+  bool changed = false;
+  for (size_t i=0;i<connected.size();i++){
+    if (connected[i].rssi != fresh[i]){ connected[i].rssi = fresh[i]; changed = true; }
+  }
+  if (changed) viewTouch(L_CONNECTED);
+}
+
+// ====== Reincidentes (lista negra / no aprobados) ======
+// Cada intento rechazado que sigue el camino normal suma un "strike". Mientras dure la penalización
+// (PENALTY_BASE_MS * 2^(strikes-1), tope PENALTY_MAX_MS) los reintentos sólo se desautentican y se
+// cuentan, sin sumar strikes ni extender la ventana: ni NVS, ni log; de la lista de espera sólo se
+// refresca lastSeenMs si ya estaba, para que la poda no la saque mientras el equipo insiste.
+// El primer intento tras vencer la ventana sigue el camino normal y registra los omitidos; además el log de cada MAC se limita a una línea por OFFENDER_LOG_MS.
+static const int MAX_OFFENDERS = 64;
+static const uint32_t PENALTY_BASE_MS   = 2000;
+static const uint32_t PENALTY_MAX_MS    = 5UL * 60UL * 1000UL;
+static const uint32_t PENALTY_RESET_MS  = 10UL * 60UL * 1000UL; // sin intentos en este lapso: se olvida
+static const uint32_t OFFENDER_LOG_MS   = 30000;
+
+struct Offender {
+  uint64_t mac;
+  uint32_t lastMs, untilMs, lastLogMs;
+  uint16_t strikes;
+  uint16_t suppressed;
+};
+FixedVec<Offender, MAX_OFFENDERS> offenders;
+
+// Registra un intento rechazado; devuelve true si llegó dentro de la penalización vigente
+bool offenderStrike(uint64_t mac, uint32_t now, Offender*& out){
+  Offender* o = nullptr;
+  for (Offender& x : offenders) if (x.mac == mac){ o = &x; break; }
+  if (!o){
+    if (offenders.full()){
+      // Reemplaza al que lleva más tiempo sin intentar
+      int lru = 0;
+      for (size_t i=1;i<offenders.size();i++) if ((int32_t)(offenders[i].lastMs - offenders[lru].lastMs) < 0) lru = i;
+      offenders.erase(lru);
+    }
+    offenders.push({mac, now, now, 0, 0, 0});
+    o = &offenders[offenders.size() - 1];
+  } else if (now - o->lastMs > PENALTY_RESET_MS){
+    o->strikes = 0;
   }
+  o->lastMs = now;
+  out = o;
+  // Dentro de la ventana no suma ni la corre: si no, un equipo que reintenta seguido nunca saldría
+  if (o->strikes > 0 && (int32_t)(o->untilMs - now) > 0) return true;
+  if (o->strikes < 0xFFFF) o->strikes++;
+  uint8_t shift = o->strikes - 1 > 10 ? 10 : o->strikes - 1;
+  uint32_t pen = PENALTY_BASE_MS << shift;
+  o->untilMs = now + (pen > PENALTY_MAX_MS ? PENALTY_MAX_MS : pen);
+  return false;
+}
+// ¿Toca escribir en el log? Si no, cuenta la línea como suprimida
+bool offenderShouldLog(Offender& o, uint32_t now){
+  if (o.lastLogMs && now - o.lastLogMs < OFFENDER_LOG_MS){
+    if (o.suppressed < 0xFFFF) o.suppressed++;
+    metrics.logSuppressed++;
+    return false;
+  }
+  o.lastLogMs = now ? now : 1;
+  return true;
+}
+// Al aprobar una MAC (formato AA:BB:CC:DD:EE:FF) se le perdonan los strikes
+void offenderForget(const char* m){
+  uint64_t mac = macStrToU64(m);
+  offenders.removeIf([mac](const Offender& o){ return o.mac == mac; });
 }
 
 // ====== Eventos WiFi (gating) ======
+// quiet = no desautenticar: evento sintético (generador de ráfagas) o reproceso de uno que ya se decidió
+// en vivo. Recorre el mismo camino sin tocar estaciones reales ni usar un AID que ya pudo reasignarse.
+void deauthStation(uint16_t aid, bool quiet = false){
+  if (quiet) return;
+  esp_wifi_deauth_sta(aid);
+  metrics.deauthSent++;
+}
+// Mientras las tablas no son las reales los eventos de asociación se guardan aquí y releaseEvents() los
+// reprocesa en orden. HOLD_ALL (arranque hasta cargar las listas, /api/bench que reemplaza las listas):
+// tampoco hay ACL confiable, se decide al reprocesar. HOLD_TABLES (corrida de /api/storm, que no toca
+// las listas): la ACL sí es la real, así que una estación no permitida se desautentica en el momento y
+// sólo se retiene la contabilidad (espera, reincidentes, historial, log). Con la cola llena no se pisa
+// ningún evento: la estación nueva se desautentica (volverá a intentar) y se cuenta en
+// metrics.bootDeferDropped.
+static const int MAX_DEFERRED_EVENTS = 32; // > estaciones simultáneas del AP (10-15) con margen
+enum EventHold : uint8_t { HOLD_NONE, HOLD_TABLES, HOLD_ALL };
+struct DeferredEvent { WiFiEvent_t event; WiFiEventInfo_t info; bool decided; };
+FixedRing<DeferredEvent, MAX_DEFERRED_EVENTS> deferredEvents;
+volatile bool listsReady = false;
+volatile uint8_t eventHold = HOLD_ALL;
+
+void handleStaEvent(WiFiEvent_t event, const WiFiEventInfo_t& info, bool quiet);
+
+// La cola y eventHold se comparten entre la tarea de eventos WiFi y loop(): push, drenado y cambio de
+// estado van bajo eventMux. La decisión contra la ACL y handleStaEvent quedan fuera de la sección crítica.
+portMUX_TYPE eventMux = portMUX_INITIALIZER_UNLOCKED;
+
+void holdEvents(EventHold h){
+  portENTER_CRITICAL(&eventMux);
+  eventHold = h;
+  portEXIT_CRITICAL(&eventMux);
+}
+
 void WiFiEventHandler(WiFiEvent_t event, WiFiEventInfo_t info) {
+  bool connect = event == ARDUINO_EVENT_WIFI_AP_STACONNECTED;
+  if (!connect && event != ARDUINO_EVENT_WIFI_AP_STADISCONNECTED) { handleStaEvent(event, info, false); return; }
+  bool decided = false;
+  if (connect && eventHold == HOLD_TABLES && aclDecide(macToU64(info.wifi_ap_staconnected.mac)) != ACL_ALLOW) {
+    deauthStation(info.wifi_ap_staconnected.aid);
+    decided = true;
+  }
+  bool held = false, dropped = false;
+  portENTER_CRITICAL(&eventMux);
+  if (eventHold != HOLD_NONE) {
+    held = true;
+    if (deferredEvents.size() < deferredEvents.capacity()) deferredEvents.push() = {event, info, decided};
+    else dropped = true;
+  }
+  portEXIT_CRITICAL(&eventMux);
+  if (dropped) {
+    metrics.bootDeferDropped++;
+    if (connect && !decided) deauthStation(info.wifi_ap_staconnected.aid);
+  }
+  if (!held) handleStaEvent(event, info, decided);
+}
+// Saca de a uno y procesa fuera del lock; lo que llegue mientras tanto se encola detrás y también se
+// drena. Recién con la cola vacía se suelta la retención, así no hay evento que quede adentro.
+void releaseEvents(){
+  DeferredEvent ev;
+  for (;;) {
+    portENTER_CRITICAL(&eventMux);
+    bool more = deferredEvents.size() > 0;
+    if (more) { ev = deferredEvents[0]; deferredEvents.pop(); }
+    else eventHold = HOLD_NONE;
+    portEXIT_CRITICAL(&eventMux);
+    if (!more) break;
+    handleStaEvent(ev.event, ev.info, ev.decided);
+  }
+}
+
+void handleStaEvent(WiFiEvent_t event, const WiFiEventInfo_t& info, bool quiet) {
+  TRACE_SCOPE(TR_WIFI_EVENT);
   if (event == ARDUINO_EVENT_WIFI_AP_STACONNECTED) {
     const wifi_event_ap_staconnected_t &conn = info.wifi_ap_staconnected;
-    String m = macToStr(conn.mac);
-    
-    if (macAllowed(m)) {
-        logEvent("MAC " + m + " se ha conectado.");
-        addOrUpdateConnected(m, conn.aid);
+    MacStr m = macFromBytes(conn.mac);
+    uint32_t now = millis();
+    uint64_t key = macToU64(conn.mac);
+    AclVerdict v = aclDecide(key);
+    Offender* o;
+
+    // Vía rápida: la lista negra se consulta primero. El AP del ESP32 no ofrece un filtro previo a
+    // la asociación, así que éste es el punto más temprano: fuera sin pasar por espera ni NVS.
+    if (v == ACL_BLACK) {
+        metrics.staBlocked++;
+        deauthStation(conn.aid, quiet);
+        offenderStrike(key, now, o);
+        if (offenderShouldLog(*o, now)) {
+          logEventf("MAC %s (lista negra) rechazada; %u intentos omitidos en el log.", m.c_str(), o->suppressed);
+          o->suppressed = 0;
+        }
+        return;
+    }
+
+    if (v == ACL_ALLOW) {
+        metrics.staConnected++;
+        logEventf("MAC %s se ha conectado.", m.c_str());
+        addOrUpdateConnected(m.c_str(), conn.aid);
+        histConnect(key);
+    }
+    else if (offenderStrike(key, now, o)) {
+        // Reintento dentro de la penalización: desautenticar, contar y mantener viva la espera
+        metrics.staPenalized++;
+        deauthStation(conn.aid, quiet);
+        int idx = findPendingIdx(m.c_str());
+        if (idx >= 0){ pending[idx].lastSeenMs = now; pending[idx].aid = conn.aid; viewSeen(L_PENDING, idx); }
+        if (o->suppressed < 0xFFFF) o->suppressed++;
+        metrics.logSuppressed++;
     }
     else {
-        logEvent("Nuevo dispositivo " + m + " intentó conectarse y fue enviado a la lista de espera.");
-        addOrUpdatePending(m, conn.aid);
-        esp_wifi_deauth_sta(conn.aid);
+        metrics.staPending++;
+        deauthStation(conn.aid, quiet);
+        addOrUpdatePending(m.c_str(), conn.aid);
+        if (offenderShouldLog(*o, now)) {
+          if (o->strikes > 1)
+            logEventf("MAC %s reintenta sin aprobación (%u intentos, %u omitidos en el log).", m.c_str(), o->strikes, o->suppressed);
+          else
+            logEventf("Nuevo dispositivo %s intentó conectarse y fue enviado a la lista de espera.", m.c_str());
+          o->suppressed = 0;
+        }
     }
   }
   else if (event == ARDUINO_EVENT_WIFI_AP_STADISCONNECTED) {
     const wifi_event_ap_stadisconnected_t &disc = info.wifi_ap_stadisconnected;
-    String m = macToStr(disc.mac);
-    logEvent("MAC " + m + " se ha desconectado.");
-    removeConnected(m);
+    metrics.staDisconnected++;
+    MacStr m = macFromBytes(disc.mac);
+    // Sólo se registra la salida de clientes admitidos; los rechazados ya quedaron en el log
+    int idx = findConnectedIdx(m.c_str());
+    if (idx < 0) return;
+    logEventf("MAC %s se ha desconectado.", m.c_str());
+    histDisconnect(macToU64(disc.mac));
+    connected.erase(idx);
+    viewTouch(L_CONNECTED);
   }
 }
 
 // ====== AUTH admin ======
 bool isAuthed(){ return server.hasArg("pass") && server.arg("pass")==ADMIN_PASSWORD; }
 bool guard(){ if(!isAuthed()){ server.send(403,"text/plain","Forbidden"); return true; } return false; }
+// Los cambios de listas esperan a que el arranque las cargue: guardar antes pisaría las de NVS
+bool guardLists(){
+  if (guard()) return true;
+  if (!listsReady){ server.sendHeader("Retry-After", "1"); server.send(503, "text/plain", "Iniciando"); return true; }
+  return false;
+}
+
+// ====== Vistas de listas (/api/list/<nombre>) ======
+// Un índice ordenado por lista y criterio, reconstruido sólo cuando la tabla cambió (viewDirty), no en
+// cada petición. Las listas blanca/negra además cachean el alias, que si no sale de NVS entrada por entrada.
+// La búsqueda (prefijo de MAC o de alias) recorre el índice ya ordenado y pagina con offset/limit.
+enum SortKey : uint8_t { S_MAC, S_ALIAS, S_SEEN, S_RSSI, S_COUNT };
+static const char* const LIST_NAMES[L_COUNT] = {"allow", "black", "connected", "pending"};
+static const char* const SORT_NAMES[S_COUNT] = {"mac", "alias", "seen", "rssi"};
+static const uint8_t LIST_SORTS[L_COUNT] = {
+  1<<S_MAC | 1<<S_ALIAS, 1<<S_MAC | 1<<S_ALIAS,
+  1<<S_MAC | 1<<S_ALIAS | 1<<S_SEEN | 1<<S_RSSI, 1<<S_MAC | 1<<S_ALIAS | 1<<S_SEEN };
+static const int VIEW_MAX = MAX_PENDING > MAX_MACS ? MAX_PENDING : MAX_MACS;
+static const int LIST_PAGE_MAX = 100;
+
+uint16_t viewIdx[L_COUNT][S_COUNT][VIEW_MAX];
+AliasStr allowAlias[MAX_MACS], blackAlias[MAX_MACS];
+
+struct ListRow { const char* mac; const char* alias; const Device* dev; };
+size_t listSize(ListId l){
+  switch (l){
+    case L_ALLOW:     return allowList.size();
+    case L_BLACK:     return blackList.size();
+    case L_CONNECTED: return connected.size();
+    default:          return pending.size();
+  }
+}
+ListRow listRow(ListId l, size_t i){
+  switch (l){
+    case L_ALLOW:     return {allowList[i].c_str(), allowAlias[i].c_str(), nullptr};
+    case L_BLACK:     return {blackList[i].c_str(), blackAlias[i].c_str(), nullptr};
+    case L_CONNECTED: return {connected[i].mac.c_str(), connected[i].alias.c_str(), &connected[i]};
+    default:          return {pending[i].mac.c_str(), pending[i].alias.c_str(), &pending[i]};
+  }
+}
+// <0 si a va antes que b. Alias vacíos al final; lo más reciente y la señal más fuerte primero.
+int rowCompare(ListId l, SortKey s, uint16_t ia, uint16_t ib){
+  ListRow a = listRow(l, ia), b = listRow(l, ib);
+  int c = 0;
+  if (s == S_ALIAS){
+    if (!*a.alias != !*b.alias) return *a.alias ? -1 : 1;
+    c = strcasecmp(a.alias, b.alias);
+  } else if (s == S_SEEN){
+    c = (int32_t)(b.dev->lastSeenMs - a.dev->lastSeenMs);
+  } else if (s == S_RSSI){
+    int ra = a.dev->rssi ? a.dev->rssi : -128, rb = b.dev->rssi ? b.dev->rssi : -128;
+    c = rb - ra;
+  }
+  return c ? c : strcmp(a.mac, b.mac);
+}
+void viewRefresh(ListId l){
+  if (!(viewDirty & (1 << l))) return;
+  viewDirty &= ~(1 << l);
+  metrics.viewRebuilds++;
+  size_t n = listSize(l);
+  if (l == L_ALLOW) for (size_t i=0;i<n;i++) getAliasFromNVS(allowList[i].c_str(), allowAlias[i]);
+  if (l == L_BLACK) for (size_t i=0;i<n;i++) getAliasFromNVS(blackList[i].c_str(), blackAlias[i]);
+  for (int s=0;s<S_COUNT;s++){
+    if (!(LIST_SORTS[l] & (1 << s))) continue;
+    uint16_t* idx = viewIdx[l][s];
+    // Inserción: n es chico y sólo se ordena cuando la tabla cambió
+    for (size_t i=0;i<n;i++){
+      size_t k = i;
+      while (k > 0 && rowCompare(l, (SortKey)s, idx[k-1], i) > 0){ idx[k] = idx[k-1]; k--; }
+      idx[k] = i;
+    }
+  }
+}
+// La fila i acaba de verse: pasa al frente del orden por S_SEEN sin reconstruir (es la más reciente)
+void viewSeen(ListId l, uint16_t i){
+  if (viewDirty & (1 << l)) return; // ya se reconstruye entera
+  uint16_t* idx = viewIdx[l][S_SEEN];
+  size_t n = listSize(l), k = 0;
+  while (k < n && idx[k] != i) k++;
+  if (k == n){ viewTouch(l); return; }
+  for (; k > 0; k--) idx[k] = idx[k-1];
+  idx[0] = i;
+}
+
+// Prefijo de MAC (ignora separadores y mayúsculas) o prefijo de alias (sin distinguir mayúsculas)
+bool rowMatches(const ListRow& r, const char* q, const char* qhex){
+  if (!*q) return true;
+  if (*qhex){
+    const char* m = r.mac; const char* h = qhex;
+    for (; *m && *m != '/' && *h; ++m){ if (*m == ':') continue; if (*m != *h) break; ++h; }
+    if (!*h) return true;
+  }
+  return strncasecmp(r.alias, q, strlen(q)) == 0;
+}
+
+void emitRow(Emitter& e, ListId l, const ListRow& r, uint32_t now){
+  bool full = strlen(r.mac) == 17;
+  e.beginObj(!r.dev ? 3 : (l == L_CONNECTED ? 6 : 5));
+  e.key(K_MAC);    e.mac(r.mac);
+  e.key(K_VENDOR); e.str(full ? macVendor(r.mac) : "");
+  e.key(K_ALIAS);  e.str(r.alias);
+  if (r.dev){
+    e.key(K_SEEN_MS); e.num(now - r.dev->lastSeenMs);
+    e.key(K_AID);     e.num(r.dev->aid);
+    if (l == L_CONNECTED){ e.key(K_RSSI); e.num(r.dev->rssi); }
+  }
+  e.endObj();
+}
+
+struct ListQuery {
+  ListId list; SortKey sort; bool desc;
+  uint32_t offset, limit;
+  char q[33], qhex[13];
+};
+ListQuery listQ;
+
+void emitList(Emitter& e){
+  const ListQuery& q = listQ;
+  uint32_t now = millis();
+  size_t n = listSize(q.list);
+  const uint16_t* idx = viewIdx[q.list][q.sort];
+  uint32_t matched = 0;
+  e.beginObj(5);
+  e.key(K_NAME);   e.str(LIST_NAMES[q.list]);
+  e.key(K_TOTAL);  e.num(n);
+  e.key(K_OFFSET); e.num(q.offset);
+  e.key(K_ITEMS);  e.beginArr();
+  for (size_t k=0;k<n;k++){
+    ListRow r = listRow(q.list, idx[q.desc ? n - 1 - k : k]);
+    if (!rowMatches(r, q.q, q.qhex)) continue;
+    if (matched >= q.offset && matched < q.offset + q.limit) emitRow(e, q.list, r, now);
+    matched++;
+  }
+  e.endArr();
+  e.key(K_MATCHED); e.num(matched);
+  e.endObj();
+}
+
+// GET /api/list/<allow|black|connected|pending>?offset=0&limit=50&q=&sort=[-]mac|alias|seen|rssi
+void handleApiList(){
+  if (guard()) return;
+  String name = server.pathArg(0);
+  int l = 0; while (l < L_COUNT && name != LIST_NAMES[l]) l++;
+  if (l == L_COUNT){ server.send(404, "text/plain", "Lista desconocida"); return; }
+  String sort = server.hasArg("sort") ? server.arg("sort") : String(l >= L_CONNECTED ? "seen" : "mac");
+  bool desc = sort.startsWith("-"); if (desc) sort.remove(0, 1);
+  int s = 0; while (s < S_COUNT && sort != SORT_NAMES[s]) s++;
+  if (s == S_COUNT || !(LIST_SORTS[l] & (1 << s))){ server.send(400, "text/plain", "Orden no soportado"); return; }
+  long off = server.arg("offset").toInt(), lim = server.hasArg("limit") ? server.arg("limit").toInt() : 50;
+  listQ.list = (ListId)l; listQ.sort = (SortKey)s; listQ.desc = desc;
+  listQ.offset = off < 0 ? 0 : off;
+  listQ.limit = lim < 1 ? 1 : (lim > LIST_PAGE_MAX ? LIST_PAGE_MAX : lim);
+  String q = server.arg("q"); q.trim();
+  snprintf(listQ.q, sizeof(listQ.q), "%s", q.c_str());
+  // Si la consulta sólo tiene dígitos hex y separadores, también se compara contra la MAC
+  size_t h = 0; bool hexOnly = true;
+  for (char c : q){
+    c = toupper((unsigned char)c);
+    if (isHexDigit(c)){ if (h < sizeof(listQ.qhex) - 1) listQ.qhex[h++] = c; }
+    else if (c != ':' && c != '-' && c != '.'){ hexOnly = false; break; }
+  }
+  listQ.qhex[hexOnly ? h : 0] = 0;
+  viewRefresh(listQ.list);
+  sendDoc(emitList);
+}
+
+// ====== API Historial ======
+// GET /api/history?pass=...           -> resumen de los clientes con historial
+// GET /api/history?pass=...&mac=...   -> sesiones y series de RSSI (1 s / 1 min / 1 h) de una MAC
+// Los tiempos van como antigüedad en segundos; las cubetas sin muestras salen como null.
+uint64_t histQueryMac = 0;
+
+void emitBucket(Emitter& e, const RssiBucket& b){
+  if (!b.avg){ e.nul(); return; }
+  e.beginArr(3); e.num(b.min); e.num(b.avg); e.num(b.max); e.endArr();
+}
+template<size_t N> void emitBuckets(Emitter& e, const FixedRing<RssiBucket, N>& r, RssiAcc open, uint32_t resS, uint32_t ageS){
+  e.beginObj(3);
+  e.key(K_RES_S);     e.num(resS);
+  e.key(K_END_AGE_S); e.num(ageS);         // inicio de la cubeta más nueva (la abierta, parcial)
+  e.key(K_POINTS);    e.beginArr(r.size() + 1);
+  for (size_t i=0;i<r.size();i++) emitBucket(e, r[i]);
+  emitBucket(e, open.take());
+  e.endArr();
+  e.endObj();
+}
+void emitHistHeader(Emitter& e, const ClientHistory& h, uint32_t now){
+  uint8_t b[6]; for (int i=0;i<6;i++) b[i] = h.mac >> (8*(5-i));
+  MacStr m = macFromBytes(b);
+  e.key(K_MAC);              e.mac(m.c_str());
+  e.key(K_VENDOR);           e.str(macVendor(h.mac));
+  e.key(K_ONLINE);           e.boolean(h.sessions.size() && !h.sessions[h.sessions.size() - 1].endS);
+  e.key(K_CONNECTS);         e.num(h.connects);
+  e.key(K_QUICK_RECONNECTS); e.num(h.quickReconnects);
+  e.key(K_FIRST_AGE_S);      e.num(now - h.firstS);
+  e.key(K_LAST_AGE_S);       e.num(now - h.lastS);
+}
+void emitHistSummary(Emitter& e){
+  uint32_t now = uptimeS();
+  e.beginObj(1);
+  e.key(K_CLIENTS); e.beginArr(history.size());
+  for (ClientHistory& h : history){
+    histAdvance(h, now);
+    e.beginObj(8);
+    emitHistHeader(e, h, now);
+    int8_t last = h.secs.size() ? h.secs[h.secs.size() - 1] : 0;
+    e.key(K_RSSI); e.num(last);
+    e.endObj();
+  }
+  e.endArr();
+  e.endObj();
+}
+void emitHistDetail(Emitter& e){
+  uint32_t now = uptimeS();
+  // Se vuelve a buscar: entre el 404 del handler y acá un evento WiFi pudo desalojar el registro. Se
+  // emite una copia (~440 B) para que un desalojo durante el envío no cambie el registro a mitad.
+  ClientHistory* hp = histFind(histQueryMac);
+  if (!hp){ e.nul(); return; }
+  histAdvance(*hp, now);
+  const ClientHistory h = *hp;
+  e.beginObj(11);
+  emitHistHeader(e, h, now);
+  e.key(K_SESSIONS); e.beginArr(h.sessions.size());
+  for (size_t i=0;i<h.sessions.size();i++){
+    const Session& s = h.sessions[i];
+    e.beginObj(2);
+    e.key(K_START_AGE_S); e.num(now - s.startS);
+    e.key(K_END_AGE_S);   if (s.endS) e.num(now - s.endS); else e.nul();
+    e.endObj();
+  }
+  e.endArr();
+  e.key(K_RSSI_1S); e.beginObj(3);
+  e.key(K_RES_S); e.num(1);
+  e.key(K_END_AGE_S); e.num(now - h.secT);
+  e.key(K_POINTS); e.beginArr(h.secs.size());
+  for (size_t i=0;i<h.secs.size();i++){ if (h.secs[i]) e.num(h.secs[i]); else e.nul(); }
+  e.endArr();
+  e.endObj();
+  e.key(K_RSSI_1M); emitBuckets(e, h.mins, h.minAcc, 60, now - h.minT * 60);
+  e.key(K_RSSI_1H); emitBuckets(e, h.hours, h.hourAcc, 3600, now - h.hourT * 3600);
+  e.endObj();
+}
+void handleApiHistory(){
+  if (guard()) return;
+  if (!server.hasArg("mac")){ sendDoc(emitHistSummary); return; }
+  String n; if (!normalizeMac(server.arg("mac"), n)){ server.send(400, "text/plain", "MAC invalida"); return; }
+  histQueryMac = macStrToU64(n.c_str());
+  if (!histFind(histQueryMac)){ server.send(404, "text/plain", "Sin historial"); return; }
+  sendDoc(emitHistDetail);
+}
 
 // ====== API Scanner ======
 void handleApiScan(){
-  String j; j.reserve(8192);
-  j += "[";
-  for (int i=0;i<netCount;i++){
-    if (i) j += ",";
-    j += "{\"ssid\":\"";
-    String s = nets[i].ssid; s.replace("\\","\\\\"); s.replace("\"","\\\"");
-    j += s; j += "\",\"bssid\":\""; j += nets[i].bssid;
-    j += "\",\"rssi\":";
-    j += String(nets[i].rssi);
-    j += ",\"quality\":";
-    j += String(qualityFromRSSI(nets[i].rssi));
-    j += ",\"channel\":";
-    j += String(nets[i].ch);
-    j += ",\"security\":\"";
-    j += encTypeToStr(nets[i].enc);
-    j += "\"}";
-  }
-  j += "]";
-  server.send(200, "application/json", j);
+  // no-cache: el navegador revalida con If-None-Match y casi siempre recibe un 304 sin cuerpo.
+  // Cada representación lleva su propio ETag; el JSON (y su gzip) sale de la caché, el CBOR se emite al vuelo.
+  bool cbor = wantCbor();
+  bool gz = !cbor && scanGzLen && server.header("Accept-Encoding").indexOf("gzip") >= 0;
+  char etag[16];
+  if (cbor)    snprintf(etag, sizeof(etag), "%.9s-c\"", scanEtag);
+  else if (gz) snprintf(etag, sizeof(etag), "%.9s-gz\"", scanEtag);
+  else         strcpy(etag, scanEtag);
+  server.sendHeader("ETag", etag);
+  server.sendHeader("Cache-Control", "no-cache");
+  server.sendHeader("Vary", "Accept, Accept-Encoding");
+  if (server.header("If-None-Match").indexOf(etag) >= 0){
+    metrics.scanNotModified++;
+    server.send(304);
+    return;
+  }
+  if (cbor){
+    streamDoc(true, [](Emitter& e){ emitScan(e); });
+  } else if (gz){
+    metrics.scanGzip++;
+    server.sendHeader("Content-Encoding", "gzip");
+    server.send_P(200, "application/json", (PGM_P)scanGz, scanGzLen);
+  } else {
+    server.send_P(200, "application/json", scanJson, scanJsonLen);
+  }
 }
 
 // ====== API Admin (JSON de estado + acciones) ======
+bool stateLists = true; // /api/state?lists=0 omite las tablas (la UI las pide paginadas a /api/list)
+void emitState(Emitter& e){
+  uint32_t now = millis();
+  e.beginObj(stateLists ? 8 : 4);
+  e.key(K_AP_SSID);   e.str(ap_ssid.c_str());
+  e.key(K_AP_PASS);   e.str(ap_pass.c_str());
+  e.key(K_FILTERING); e.boolean(filteringEnabled);
+  if (stateLists){
+    static const ApiKey keys[L_COUNT] = {K_ALLOWED, K_BLACK, K_CONNECTED, K_PENDING};
+    for (int l=0;l<L_COUNT;l++){
+      viewRefresh((ListId)l);
+      size_t n = listSize((ListId)l);
+      e.key(keys[l]); e.beginArr(n);
+      for (size_t i=0;i<n;i++) emitRow(e, (ListId)l, listRow((ListId)l, i), now);
+      e.endArr();
+    }
+  }
+  e.key(K_NEW_PENDING); e.boolean(isNewPending);
+  e.endObj();
+}
+String buildStateJson(){
+  String j; j.reserve(12000);
+  Emitter e(false, stringSink, &j);
+  emitState(e);
+  e.flush();
+  return j;
+}
+
 void handleApiState(){
   if (guard()) return;
   prunePending();
-
-  String j; j.reserve(12000);
-  j += "{\"ap_ssid\":\""; j += jsonEscape(ap_ssid);
-  j += "\",\"ap_pass\":\""; j += jsonEscape(ap_pass);
-  j += "\",\"filtering\":"; j += (filteringEnabled? "true":"false");
-  j += ",\"allowed\":[";
-  for (int i=0;i<allowCount;i++){ 
-    if(i) j+=','; 
-    j += "{\"mac\":\""; j += allowList[i];
-    j += "\",\"alias\":\""; j += jsonEscape(getAliasFromNVS(allowList[i])); j += "\"}";
-  }
-  j += "],\"black\":[";
-  for (int i=0;i<blackCount;i++){ 
-    if(i) j+=','; 
-    j += "{\"mac\":\""; j += blackList[i];
-    j += "\",\"alias\":\""; j += jsonEscape(getAliasFromNVS(blackList[i])); j += "\"}";
-  }
-  j += "],\"connected\":[";
-  uint32_t now = millis();
-  for (int i=0;i<connectedCount;i++){
-    if(i) j+=',';
-    j += "{\"mac\":\""; j+=connected[i].mac; 
-    j += "\",\"alias\":\""; j += jsonEscape(connected[i].alias);
-    j += "\",\"seen_ms\":"; j += String(now - connected[i].lastSeenMs);
-    j += ",\"aid\":"; j += String(connected[i].aid);
-    j += ",\"rssi\":"; j += String((int)connected[i].rssi);
-    j += "}";
-  }
-  j += "],\"pending\":[";
-  for (int i=0;i<pendingCount;i++){
-    if(i) j+=',';
-    j += "{\"mac\":\""; j+=pending[i].mac; 
-    j += "\",\"alias\":\""; j += jsonEscape(pending[i].alias);
-    j += ",\"seen_ms\":"; j += String(now - pending[i].lastSeenMs);
-    j += ",\"aid\":"; j += String(pending[i].aid); j += "}";
-  }
-  j += "],\"newPending\":"; j += (isNewPending ? "true" : "false");
-  j += "}";
-  server.send(200, "application/json", j);
+  stateLists = server.arg("lists") != "0";
+  sendDoc(emitState);
   isNewPending = false; // Reset flag after sending
 }
 
+// "time" es texto para la UI; los clientes CBOR usan sólo age_ms
+void emitLog(Emitter& e){
+  uint32_t now = millis();
+  e.beginArr(eventLog.size());
+  for (size_t i = 0; i < eventLog.size(); ++i) {
+    e.beginObj(e.cbor ? 2 : 3);
+    if (!e.cbor){ e.key(K_TIME); e.str(timeAgo(now - eventLog[i].timestamp).c_str()); }
+    e.key(K_AGE_MS);  e.num(now - eventLog[i].timestamp);
+    e.key(K_MESSAGE); e.str(eventLog[i].message.c_str());
+    e.endObj();
+  }
+  e.endArr();
+}
 void handleApiLog() {
   if (guard()) return;
-  String j;
-  j += "[";
+  sendDoc(emitLog);
+}
+// "time" es texto para la UI; prev_security es null en las alertas "impostor"
+void emitAlerts(Emitter& e){
   uint32_t now = millis();
-  for (int i = 0; i < logCount; ++i) {
-    if (i) j += ",";
-    j += "{\"time\":\"";
-    j += timeAgo(now - eventLog[i].timestamp);
-    j += "\",\"message\":\"";
-    j += jsonEscape(eventLog[i].message);
-    j += "\"}";
-  }
-  j += "]";
-  server.send(200, "application/json", j);
+  e.beginArr(rogueAlerts.size());
+  for (size_t i=0;i<rogueAlerts.size();i++){
+    const RogueAlert& a = rogueAlerts[i];
+    MacStr m = macFromBytes(a.bssid);
+    e.beginObj(e.cbor ? 9 : 10);
+    if (!e.cbor){ e.key(K_TIME); e.str(timeAgo(now - a.timestamp).c_str()); }
+    e.key(K_AGE_MS);        e.num(now - a.timestamp);
+    e.key(K_KIND);          e.str(ROGUE_KIND_NAMES[a.kind]);
+    e.key(K_SSID);          e.str(a.ssid.c_str());
+    e.key(K_BSSID);         e.mac(m.c_str());
+    e.key(K_VENDOR);        e.str(macVendor(m.c_str()));
+    e.key(K_CHANNEL);       e.num(a.ch);
+    e.key(K_RSSI);          e.num(a.rssi);
+    e.key(K_SECURITY);      e.str(encTypeToStr((wifi_auth_mode_t)a.auth));
+    e.key(K_PREV_SECURITY); if (a.prevAuth == 0xFF) e.nul(); else e.str(encTypeToStr((wifi_auth_mode_t)a.prevAuth));
+    e.endObj();
+  }
+  e.endArr();
+}
+void handleApiAlerts(){
+  if (guard()) return;
+  sendDoc(emitAlerts);
+}
+void emitSchema(Emitter& e){
+  e.beginArr(K_COUNT);
+  for (int i=0;i<K_COUNT;i++) e.str(API_KEY_NAMES[i]);
+  e.endArr();
+}
+void handleApiSchema(){ sendDoc(emitSchema); }
+
+// ====== /metrics (Prometheus) ======
+void metricsCounter(String& o, const char* name, const char* help, uint32_t v){
+  o += "# HELP "; o += name; o += ' '; o += help; o += '\n';
+  o += "# TYPE "; o += name; o += " counter\n";
+  o += name; o += ' '; o += String(v); o += '\n';
+}
+void metricsGauge(String& o, const char* name, const char* help, uint32_t v){
+  o += "# HELP "; o += name; o += ' '; o += help; o += '\n';
+  o += "# TYPE "; o += name; o += " gauge\n";
+  o += name; o += ' '; o += String(v); o += '\n';
+}
+// Serie de un histograma; 'labels' va sin llaves (p.ej. "handler=\"/\"") o vacío
+void metricsHistSeries(String& o, const char* name, const char* labels, const LatencyHist& h){
+  uint32_t cum = 0;
+  for (int b=0;b<HIST_BUCKETS;b++){
+    cum += h.buckets[b];
+    o += name; o += "_bucket{";
+    if (labels[0]){ o += labels; o += ','; }
+    o += "le=\"";
+    if (b < HIST_BUCKETS - 1) o += String(HIST_BOUNDS_US[b] / 1e6, 4); else o += "+Inf";
+    o += "\"} "; o += String(cum); o += '\n';
+  }
+  String lb = labels[0] ? String("{") + labels + "}" : String();
+  o += name; o += "_sum"; o += lb; o += ' '; o += String(h.sumUs / 1e6, 6); o += '\n';
+  o += name; o += "_count"; o += lb; o += ' '; o += String(h.count); o += '\n';
+}
+void metricsHist(String& o, const char* name, const char* help, const LatencyHist& h){
+  o += "# HELP "; o += name; o += ' '; o += help; o += '\n';
+  o += "# TYPE "; o += name; o += " histogram\n";
+  metricsHistSeries(o, name, "", h);
+}
+
+void handleMetrics(){
+  if (guard()) return;
+  String o; o.reserve(8192);
+  metricsGauge(o, "esp32_uptime_seconds", "Segundos desde el arranque.", millis() / 1000);
+  metricsGauge(o, "esp32_heap_free_bytes", "Heap libre.", ESP.getFreeHeap());
+  metricsGauge(o, "esp32_heap_min_free_bytes", "Minimo historico de heap libre.", ESP.getMinFreeHeap());
+  metricsGauge(o, "esp32_heap_largest_block_bytes", "Mayor bloque asignable.", ESP.getMaxAllocHeap());
+  metricsGauge(o, "esp32_clients_connected", "Clientes en la tabla de conectados.", connected.size());
+  metricsGauge(o, "esp32_clients_pending", "Dispositivos en espera.", pending.size());
+  metricsGauge(o, "esp32_acl_allow_entries", "Entradas de la lista blanca.", allowList.size());
+  metricsGauge(o, "esp32_acl_black_entries", "Entradas de la lista negra.", blackList.size());
+  metricsGauge(o, "esp32_scan_networks", "Redes del ultimo escaneo.", nets.size());
+  metricsCounter(o, "esp32_nvs_reads_total", "Lecturas de NVS.", metrics.nvsReads);
+  metricsCounter(o, "esp32_nvs_writes_total", "Escrituras/borrados en NVS.", metrics.nvsWrites);
+  metricsCounter(o, "esp32_wifi_sta_connected_total", "Asociaciones aceptadas.", metrics.staConnected);
+  metricsCounter(o, "esp32_wifi_sta_pending_total", "Asociaciones enviadas a espera.", metrics.staPending);
+  metricsCounter(o, "esp32_wifi_sta_disconnected_total", "Desasociaciones.", metrics.staDisconnected);
+  metricsCounter(o, "esp32_wifi_sta_blocked_total", "Asociaciones de la lista negra rechazadas por la via rapida.", metrics.staBlocked);
+  metricsCounter(o, "esp32_wifi_sta_penalized_total", "Reintentos dentro de la penalizacion.", metrics.staPenalized);
+  metricsCounter(o, "esp32_wifi_deauth_total", "Desautenticaciones enviadas.", metrics.deauthSent);
+  metricsCounter(o, "esp32_scans_total", "Escaneos ejecutados.", metrics.scans);
+  metricsCounter(o, "esp32_scan_results_total", "Redes vistas en todos los escaneos.", metrics.scanResults);
+  o += "# HELP esp32_scan_last_duration_seconds Duracion del ultimo escaneo completo (asincrono).\n";
+  o += "# TYPE esp32_scan_last_duration_seconds gauge\n";
+  o += "esp32_scan_last_duration_seconds "; o += String(metrics.scanLastMs / 1e3, 3); o += '\n';
+  metricsCounter(o, "esp32_api_scan_not_modified_total", "Respuestas 304 de /api/scan.", metrics.scanNotModified);
+  metricsCounter(o, "esp32_api_scan_gzip_total", "Respuestas gzip de /api/scan.", metrics.scanGzip);
+  metricsCounter(o, "esp32_api_cbor_total", "Respuestas CBOR de la API.", metrics.apiCbor);
+  metricsCounter(o, "esp32_list_index_rebuilds_total", "Reconstrucciones de indices de /api/list.", metrics.viewRebuilds);
+  metricsGauge(o, "esp32_api_scan_bytes", "Tamano del JSON de /api/scan en cache.", scanJsonLen);
+  metricsGauge(o, "esp32_api_scan_gzip_bytes", "Tamano de la variante gzip (0 = no cabe).", scanGzLen);
+  metricsCounter(o, "esp32_log_events_total", "Eventos registrados en el log.", metrics.logEvents);
+  metricsCounter(o, "esp32_log_suppressed_total", "Lineas de log omitidas por limite de frecuencia.", metrics.logSuppressed);
+  metricsCounter(o, "esp32_boot_deferred_dropped_total", "Asociaciones desautenticadas por cola de arranque llena.", metrics.bootDeferDropped);
+  metricsCounter(o, "esp32_rogue_alerts_total", "Alertas de APs suplantadores o cambios de seguridad.", metrics.rogueAlerts);
+  metricsGauge(o, "esp32_rogue_fingerprints", "Huellas (SSID, BSSID) conocidas.", rogue.aps.size());
+  metricsGauge(o, "esp32_offenders", "MACs en la tabla de reincidentes.", offenders.size());
+  metricsGauge(o, "esp32_history_clients", "Clientes con historial de sesiones/RSSI.", history.size());
+  metricsHist(o, "esp32_loop_seconds", "Duracion de cada iteracion de loop().", metrics.loop);
+  metricsHist(o, "esp32_scan_seconds", "Duracion del procesado de resultados del escaneo.", metrics.scan);
+  metricsHist(o, "esp32_dns_seconds", "Duracion de dnsServer.processNextRequest().", metrics.dns);
+  o += "# HELP esp32_boot_phase_seconds Instante (desde el arranque) en que termino cada fase.\n";
+  o += "# TYPE esp32_boot_phase_seconds gauge\n";
+  for (int i=0;i<BOOT_COUNT;i++){
+    if (!bootUs[i]) continue;
+    o += "esp32_boot_phase_seconds{phase=\""; o += BOOT_PHASE_NAMES[i]; o += "\"} "; o += String(bootUs[i] / 1e6, 3); o += '\n';
+  }
+  o += "# HELP esp32_http_request_seconds Latencia de cada ruta HTTP.\n";
+  o += "# TYPE esp32_http_request_seconds histogram\n";
+  for (int i=0;i<routeCount;i++){
+    String lb = String("handler=\"") + routeMetrics[i].path + "\"";
+    metricsHistSeries(o, "esp32_http_request_seconds", lb.c_str(), routeMetrics[i].h);
+  }
+  o += "# HELP esp32_job_seconds Duracion de cada trabajo del planificador.\n";
+  o += "# TYPE esp32_job_seconds histogram\n";
+  for (int i=0;i<jobCount;i++){
+    if (!jobs[i].periodMs) continue;
+    String lb = String("job=\"") + jobs[i].name + "\"";
+    metricsHistSeries(o, "esp32_job_seconds", lb.c_str(), jobs[i].h);
+  }
+  o += "# HELP esp32_job_overruns_total Ejecuciones que excedieron su presupuesto.\n";
+  o += "# TYPE esp32_job_overruns_total counter\n";
+  for (int i=0;i<jobCount;i++){
+    if (!jobs[i].periodMs) continue;
+    o += "esp32_job_overruns_total{job=\""; o += jobs[i].name; o += "\"} "; o += String(jobs[i].overruns); o += '\n';
+  }
+  o += "# HELP esp32_job_jitter_max_seconds Maximo atraso de arranque respecto del deadline.\n";
+  o += "# TYPE esp32_job_jitter_max_seconds gauge\n";
+  for (int i=0;i<jobCount;i++){
+    if (!jobs[i].periodMs) continue;
+    o += "esp32_job_jitter_max_seconds{job=\""; o += jobs[i].name; o += "\"} "; o += String(jobs[i].maxJitterMs / 1e3, 3); o += '\n';
+  }
+  server.send(200, "text/plain; version=0.0.4", o);
 }
 
 void handleDeauth(){
@@ -472,9 +2134,9 @@ void handleDeauth(){
   if (!server.hasArg("mac")){ server.send(400,"text/plain","Falta mac"); return; }
   String n; if(!normalizeMac(server.arg("mac"),n)){ server.send(400,"text/plain","MAC invalida"); return; }
 
-  int idx = findConnectedIdx(n);
+  int idx = findConnectedIdx(n.c_str());
   if (idx >= 0) {
-    esp_wifi_deauth_sta(connected[idx].aid);
+    deauthStation(connected[idx].aid);
     logEvent("Se ha desautenticado a " + n + " de la red.");
     server.send(200, "text/plain", "OK");
   } else {
@@ -523,71 +2185,76 @@ void handleStopSniffer() {
 void handleAddAlias(){
   if(guard()) return;
   if (!server.hasArg("mac") || !server.hasArg("alias")){ server.send(400,"text/plain","Faltan mac o alias"); return; }
-  String n; if(!normalizeMac(server.arg("mac"),n)){ server.send(400,"text/plain","MAC invalida"); return; }
-  saveAliasToNVS(n, server.arg("alias"));
+  String n; if(!normalizeRule(server.arg("mac"),n)){ server.send(400,"text/plain","MAC o prefijo invalido"); return; }
+  saveAliasToNVS(n.c_str(), server.arg("alias"));
+  int i = findConnectedIdx(n.c_str()); if (i >= 0) connected[i].alias = server.arg("alias");
+  i = findPendingIdx(n.c_str());       if (i >= 0) pending[i].alias = server.arg("alias");
+  viewDirty = 0xFF;
   logEvent("Se ha cambiado el alias para " + n + ".");
   server.send(200, "text/plain", "OK");
 }
 
-void handleAddAllow(){ if (guard()) return;
+void handleAddAllow(){ if (guardLists()) return;
   if (!server.hasArg("mac")){ server.send(400,"text/plain","Falta mac"); return; }
-  String n; if(!normalizeMac(server.arg("mac"),n)){ server.send(400,"text/plain","MAC invalida"); return; }
-  if (addMacAllow(n)){ 
+  String n; if(!normalizeRule(server.arg("mac"),n)){ server.send(400,"text/plain","MAC o prefijo invalido"); return; }
+  if (addMacAllow(n.c_str())){ 
     saveAllowToNVS(); 
     logEvent("Se ha agregado " + n + " a la lista blanca.");
     server.send(200,"text/plain","OK"); 
   } else server.send(409,"text/plain","No agregado");
 }
-void handleDelAllow(){ if (guard()) return;
+void handleDelAllow(){ if (guardLists()) return;
   if (!server.hasArg("mac")){ server.send(400,"text/plain","Falta mac"); return; }
-  String n; if(!normalizeMac(server.arg("mac"),n)){ server.send(400,"text/plain","MAC invalida"); return; }
-  if (delMacAllow(n)){ 
+  String n; if(!normalizeRule(server.arg("mac"),n)){ server.send(400,"text/plain","MAC o prefijo invalido"); return; }
+  if (delMacAllow(n.c_str())){ 
     saveAllowToNVS(); 
-    deleteAliasFromNVS(n);
+    deleteAliasFromNVS(n.c_str());
     logEvent("Se ha eliminado " + n + " de la lista blanca.");
     server.send(200,"text/plain","OK"); 
   } else server.send(404,"text/plain","No encontrado");
 }
-void handleApprove(){ if (guard()) return;
+void handleApprove(){ if (guardLists()) return;
   if (!server.hasArg("mac")){ server.send(400,"text/plain","Falta mac"); return; }
   String n; if(!normalizeMac(server.arg("mac"),n)){ server.send(400,"text/plain","MAC invalida"); return; }
-  if (addMacAllow(n)) saveAllowToNVS();
-  int idx=findPendingIdx(n); if(idx>=0){ for(int j=idx+1;j<pendingCount;j++) pending[j-1]=pending[j]; pendingCount--; }
+  if (addMacAllow(n.c_str())) saveAllowToNVS();
+  removePending(n.c_str());
+  offenderForget(n.c_str());
   logEvent("Se ha aprobado " + n + " y se agregó a la lista blanca.");
   server.send(200,"text/plain","OK");
 }
-void handleAddBlack(){ if (guard()) return;
+void handleAddBlack(){ if (guardLists()) return;
   if (!server.hasArg("mac")){ server.send(400,"text/plain","Falta mac"); return; }
-  String n; if(!normalizeMac(server.arg("mac"),n)){ server.send(400,"text/plain","MAC invalida"); return; }
-  if (addMacBlack(n)){ 
+  String n; if(!normalizeRule(server.arg("mac"),n)){ server.send(400,"text/plain","MAC o prefijo invalido"); return; }
+  if (addMacBlack(n.c_str())){ 
     saveBlackToNVS(); 
     logEvent("Se ha agregado " + n + " a la lista negra.");
     server.send(200,"text/plain","OK"); 
   } else server.send(409,"text/plain","No agregado");
 }
-void handleDelBlack(){ if (guard()) return;
+void handleDelBlack(){ if (guardLists()) return;
   if (!server.hasArg("mac")){ server.send(400,"text/plain","Falta mac"); return; }
-  String n; if(!normalizeMac(server.arg("mac"),n)){ server.send(400,"text/plain","MAC invalida"); return; }
-  if (delMacBlack(n)){ 
+  String n; if(!normalizeRule(server.arg("mac"),n)){ server.send(400,"text/plain","MAC o prefijo invalido"); return; }
+  if (delMacBlack(n.c_str())){ 
     saveBlackToNVS(); 
-    deleteAliasFromNVS(n);
+    deleteAliasFromNVS(n.c_str());
     logEvent("Se ha eliminado " + n + " de la lista negra.");
     server.send(200,"text/plain","OK"); 
   } else server.send(404,"text/plain","No encontrado");
 }
-void handleToBlack(){ if (guard()) return;
+void handleToBlack(){ if (guardLists()) return;
   if (!server.hasArg("mac")){ server.send(400,"text/plain","Falta mac"); return; }
-  String n; if(!normalizeMac(server.arg("mac"),n)){ server.send(400,"text/plain","MAC invalida"); return; }
-  delMacAllow(n); saveAllowToNVS(); addMacBlack(n); saveBlackToNVS();
-  int idx=findPendingIdx(n); if(idx>=0){ for(int j=idx+1;j<pendingCount;j++) pending[j-1]=pending[j]; pendingCount--; }
+  String n; if(!normalizeRule(server.arg("mac"),n)){ server.send(400,"text/plain","MAC o prefijo invalido"); return; }
+  delMacAllow(n.c_str()); saveAllowToNVS(); addMacBlack(n.c_str()); saveBlackToNVS();
+  removePending(n.c_str());
   logEvent("Se ha movido " + n + " a la lista negra.");
   server.send(200,"text/plain","OK");
 }
-void handleToAllow(){ if (guard()) return;
+void handleToAllow(){ if (guardLists()) return;
   if (!server.hasArg("mac")){ server.send(400,"text/plain","Falta mac"); return; }
-  String n; if(!normalizeMac(server.arg("mac"),n)){ server.send(400,"text/plain","MAC invalida"); return; }
-  delMacBlack(n); saveBlackToNVS(); addMacAllow(n); saveAllowToNVS();
-  int idx=findPendingIdx(n); if(idx>=0){ for(int j=idx+1;j<pendingCount;j++) pending[j-1]=pending[j]; pendingCount--; }
+  String n; if(!normalizeRule(server.arg("mac"),n)){ server.send(400,"text/plain","MAC o prefijo invalido"); return; }
+  delMacBlack(n.c_str()); saveBlackToNVS(); addMacAllow(n.c_str()); saveAllowToNVS();
+  removePending(n.c_str());
+  offenderForget(n.c_str());
   logEvent("Se ha movido " + n + " a la lista blanca.");
   server.send(200,"text/plain","OK");
 }
@@ -600,8 +2267,12 @@ void handleSetAPSettings() {
   }
   String new_ssid = server.arg("ssid");
   String new_pass = server.arg("pass");
-  if (new_pass.length() < 8) {
-      server.send(400, "text/plain", "Contraseña debe tener al menos 8 caracteres.");
+  if (new_pass.length() < 8 || new_pass.length() > 63) {
+      server.send(400, "text/plain", "Contraseña debe tener entre 8 y 63 caracteres.");
+      return;
+  }
+  if (!new_ssid.length() || new_ssid.length() > 32) {
+      server.send(400, "text/plain", "SSID debe tener entre 1 y 32 caracteres.");
       return;
   }
 
@@ -637,7 +2308,7 @@ tr:last-child td{border-bottom:none}
 <div class="container">
   <div class="header">
     <div class="h1">ESP32 Network Scanner</div>
-    <div class="tag">AP: <span id="ap-ssid"></span></div>
+    <div class="tag">AP: <span id="ap-ssid">%AP_SSID%</span></div>
     <div>
       <a class="btn" href="/admin?pass=admin1234">Panel de Administración</a>
       <button class="btn" onclick="manualScan()">Escanear ahora</button>
@@ -656,23 +2327,20 @@ tr:last-child td{border-bottom:none}
   </div>
 </div>
 <script>
-function render(rows, apSsid){
+function render(rows){
   const tb=document.querySelector("#tbl tbody"); tb.innerHTML="";
-  document.getElementById('ap-ssid').innerText = apSsid;
   rows.forEach((r,i)=>{
     const tr=document.createElement("tr");
     const bar=`<div class="progress"><div style="width:${r.quality}%"></div></div>`;
-    tr.innerHTML=`<td>${i+1}</td><td>${r.ssid}</td><td><code>${r.bssid}</code></td><td>${r.security}</td><td>${r.channel}</td><td>${r.rssi} dBm</td><td>${r.quality}% ${bar}</td>`;
+    tr.innerHTML=`<td>${i+1}</td><td>${r.ssid}</td><td><code>${r.bssid}</code>${r.vendor?`<br><small style="color:var(--muted)">${r.vendor}</small>`:''}</td><td>${r.security}</td><td>${r.channel}</td><td>${r.rssi} dBm</td><td>${r.quality}% ${bar}</td>`;
     tb.appendChild(tr);
   });
 }
 async function refresh(){
   try{
-    const r=await fetch("/api/state?pass=admin1234");
-    const state=await r.json();
     const rScan=await fetch("/api/scan");
     const networks=await rScan.json();
-    render(networks, state.ap_ssid);
+    render(networks);
   }catch(e){console.error(e)}
 }
 function manualScan(){ fetch("/api/rescan").then(()=>setTimeout(refresh,1200)); }
@@ -680,8 +2348,16 @@ setInterval(refresh,2000); refresh();
 </script>
 </body></html>)rawliteral";
 }
-void handleRoot(){ server.send(200, "text/html", htmlScanner()); }
-void handleRescan(){ runScan(); server.send(200,"text/plain","OK"); }
+// ap_ssid sólo cambia con un reinicio: va en la página y el refresco periódico pide únicamente /api/scan
+void handleRoot(){
+  String ssid = ap_ssid;
+  ssid.replace("&", "&amp;"); ssid.replace("<", "&lt;"); ssid.replace(">", "&gt;");
+  String h = htmlScanner();
+  h.replace("%AP_SSID%", ssid.c_str());
+  server.send(200, "text/html", h);
+}
+int scanJob = -1;
+void handleRescan(){ schedKick(scanJob); server.send(200,"text/plain","OK"); }
 
 // ====== UI Admin (/admin) ======
 String htmlAdmin(){
@@ -711,6 +2387,12 @@ code{background:rgba(255,255,255,.06);padding:2px 6px;border-radius:6px}
 .modal-content{background:var(--card);padding:25px;border-radius:12px;min-width:300px;text-align:center;box-shadow:0 10px 25px rgba(0,0,0,.5)}
 .event-log{background:#28283d;border-radius:8px;padding:15px;max-height:250px;overflow-y:auto;font-family:monospace;font-size:12px}
 .event-log-item{margin-bottom:8px;line-height:1.4} .event-log-time{color:var(--muted);margin-right:10px}
+.alert-kind{color:var(--bad);font-weight:600;margin-right:10px}
+.vscroll{height:360px;overflow-y:auto} .vscroll table{border-spacing:0}
+.vscroll td{height:52px;padding-top:0;padding-bottom:0;white-space:nowrap;overflow:hidden}
+.vscroll thead th{position:sticky;top:0;background:var(--card);padding:8px 10px}
+.list-tools{margin-bottom:10px;align-items:center} .list-tools .input{flex:1;padding:8px;border-radius:8px;border:1px solid #444;background:#28283d;color:var(--txt)}
+.list-tools select{padding:8px;border-radius:8px;border:1px solid #444;background:#28283d;color:var(--txt)} .list-tools small{color:var(--muted)}
 .status-indicator{font-size:.9rem;font-weight:600;padding:4px 10px;border-radius:20px}
 .status-indicator.active{background:rgba(46,204,113,.2);color:var(--ok)}
 .status-indicator.inactive{background:rgba(255,107,107,.2);color:var(--bad)}
@@ -730,11 +2412,21 @@ code{background:rgba(255,255,255,.06);padding:2px 6px;border-radius:6px}
   <div class="row">
     <div class="col card">
       <h3>Clientes Conectados</h3>
-      <table id="tblConn"><thead><tr><th>MAC</th><th>Alias</th><th>Último Visto</th><th>RSSI</th><th>Acciones</th></tr></thead><tbody></tbody></table>
+      <div class="btn-group list-tools">
+        <input class="input" placeholder="Buscar MAC o alias" oninput="lists.connected.search(this.value)">
+        <select onchange="lists.connected.sort(this.value)"><option value="seen">Último visto</option><option value="rssi">RSSI</option><option value="alias">Alias</option><option value="mac">MAC</option></select>
+        <small id="cnt-connected"></small>
+      </div>
+      <div class="vscroll"><table id="tblConn"><thead><tr><th>MAC</th><th>Alias</th><th>Último Visto</th><th>RSSI</th><th>Acciones</th></tr></thead><tbody></tbody></table></div>
     </div>
     <div class="col card">
       <h3>Dispositivos en Espera</h3>
-      <table id="tblPend"><thead><tr><th>MAC</th><th>Alias</th><th>Visto Hace</th><th>Acción</th></tr></thead><tbody></tbody></table>
+      <div class="btn-group list-tools">
+        <input class="input" placeholder="Buscar MAC o alias" oninput="lists.pending.search(this.value)">
+        <select onchange="lists.pending.sort(this.value)"><option value="seen">Visto hace</option><option value="alias">Alias</option><option value="mac">MAC</option></select>
+        <small id="cnt-pending"></small>
+      </div>
+      <div class="vscroll"><table id="tblPend"><thead><tr><th>MAC</th><th>Alias</th><th>Visto Hace</th><th>Acción</th></tr></thead><tbody></tbody></table></div>
     </div>
   </div>
 
@@ -742,24 +2434,34 @@ code{background:rgba(255,255,255,.06);padding:2px 6px;border-radius:6px}
     <div class="col card">
       <h3>Lista Blanca</h3>
       <form class="input-group" onsubmit="return addAllow(event)">
-        <label for="macAllow">Agregar MAC a la Lista Blanca</label>
+        <label for="macAllow">Agregar MAC o prefijo (/24, /28, /36) a la Lista Blanca</label>
         <div class="btn-group">
-          <input class="input" id="macAllow" placeholder="AA:BB:CC:DD:EE:FF">
+          <input class="input" id="macAllow" placeholder="AA:BB:CC:DD:EE:FF o AA:BB:CC/24">
           <button class="btn ok" type="submit">Agregar</button>
         </div>
       </form>
-      <table id="tblAllow"><thead><tr><th>MAC</th><th>Alias</th><th>Acciones</th></tr></thead><tbody></tbody></table>
+      <div class="btn-group list-tools">
+        <input class="input" placeholder="Buscar MAC o alias" oninput="lists.allow.search(this.value)">
+        <select onchange="lists.allow.sort(this.value)"><option value="mac">MAC</option><option value="alias">Alias</option></select>
+        <small id="cnt-allow"></small>
+      </div>
+      <div class="vscroll"><table id="tblAllow"><thead><tr><th>MAC</th><th>Alias</th><th>Acciones</th></tr></thead><tbody></tbody></table></div>
     </div>
     <div class="col card">
       <h3>Lista Negra</h3>
       <form class="input-group" onsubmit="return addBlack(event)">
-        <label for="macBlack">Agregar MAC a la Lista Negra</label>
+        <label for="macBlack">Agregar MAC o prefijo (/24, /28, /36) a la Lista Negra</label>
         <div class="btn-group">
-          <input class="input" id="macBlack" placeholder="AA:BB:CC:DD:EE:FF">
+          <input class="input" id="macBlack" placeholder="AA:BB:CC:DD:EE:FF o AA:BB:CC/24">
           <button class="btn bad" type="submit">Bloquear</button>
         </div>
       </form>
-      <table id="tblBlack"><thead><tr><th>MAC</th><th>Alias</th><th>Acciones</th></tr></thead><tbody></tbody></table>
+      <div class="btn-group list-tools">
+        <input class="input" placeholder="Buscar MAC o alias" oninput="lists.black.search(this.value)">
+        <select onchange="lists.black.sort(this.value)"><option value="mac">MAC</option><option value="alias">Alias</option></select>
+        <small id="cnt-black"></small>
+      </div>
+      <div class="vscroll"><table id="tblBlack"><thead><tr><th>MAC</th><th>Alias</th><th>Acciones</th></tr></thead><tbody></tbody></table></div>
     </div>
   </div>
 
@@ -789,6 +2491,11 @@ code{background:rgba(255,255,255,.06);padding:2px 6px;border-radius:6px}
     </div>
   </div>
 
+  <div class="card">
+      <h3>Alertas de Red <span id="alert-count" class="status-indicator"></span></h3>
+      <div id="alertLog" class="event-log"></div>
+  </div>
+
   <div class="card">
       <h3>Log de Eventos</h3>
       <div id="eventLog" class="event-log"></div>
@@ -816,9 +2523,54 @@ const modalMacInput=document.getElementById('modalMac');
 const modalAliasInput=document.getElementById('modalAliasInput');
 let lastLogCount=0;
 
+// Listas con scroll virtual: sólo se piden y dibujan las filas visibles (/api/list), con búsqueda y orden
+// resueltos en el ESP32. Filas de alto fijo; dos filas espaciadoras mantienen el alto total del scroll.
+const ROW_H=52, OVERSCAN=5;
+const rowHTML=(d, cols, actions)=>{
+  const aliasHTML = `<span class="alias-text">${d.alias||''}</span> <button class="btn edit" onclick="openModal('${d.mac}', '${d.alias||''}')">✎</button>`;
+  const vendor = d.vendor ? `<br><small style="color:var(--muted)">${d.vendor}</small>` : '';
+  let h = `<tr><td><code>${d.mac}</code>${vendor}</td><td>${aliasHTML}</td>`;
+  if (cols.includes('seen')) h += `<td>${fmt(d.seen_ms)}</td>`;
+  if (cols.includes('aid')) h += `<td>${d.aid}</td>`;
+  if (cols.includes('rssi')) h += `<td>${d.rssi} dBm</td>`;
+  return h + `<td>${actions(d)}</td></tr>`;
+}
+const makeList=(name, tbl, cols, actions, sort)=>{
+  const box=document.getElementById(tbl).parentElement;
+  const tb=document.querySelector(`#${tbl} tbody`);
+  const st={q:'', sort, seq:0};
+  const spacer=(px)=>`<tr><td colspan="9" style="height:${px}px;padding:0;border:none"></td></tr>`;
+  const load=async()=>{
+    const first=Math.max(0, Math.floor(box.scrollTop/ROW_H)-OVERSCAN);
+    const limit=Math.ceil(box.clientHeight/ROW_H)+2*OVERSCAN;
+    const seq=++st.seq;
+    try{
+      const r=await fetch(`/api/list/${name}?pass=${encodeURIComponent(PASS)}&offset=${first}&limit=${limit}&sort=${st.sort}&q=${encodeURIComponent(st.q)}`);
+      const j=await r.json();
+      if (seq!==st.seq) return; // ya hay una respuesta más nueva en camino
+      tb.innerHTML = spacer(first*ROW_H) + j.items.map(d=>rowHTML(d, cols, actions)).join('') +
+                     spacer(Math.max(0, j.matched-first-j.items.length)*ROW_H);
+      document.getElementById('cnt-'+name).innerText = st.q ? `${j.matched} de ${j.total}` : `${j.total}`;
+    }catch(e){console.error("Error fetching list:",e)}
+  };
+  let t=null;
+  box.addEventListener('scroll',()=>{clearTimeout(t);t=setTimeout(load,60);});
+  return {load, search:(v)=>{st.q=v.trim();box.scrollTop=0;load();}, sort:(v)=>{st.sort=v;box.scrollTop=0;load();}};
+}
+const lists={
+  connected: makeList('connected', 'tblConn', ['seen', 'aid', 'rssi'], d =>
+    `<button class="btn bad" onclick="deauth('${d.mac}')">Desautenticar</button>`, 'seen'),
+  pending: makeList('pending', 'tblPend', ['seen'], d =>
+    `<button class="btn ok" onclick="approve('${d.mac}')">Aprobar</button><button class="btn bad" onclick="toBlack('${d.mac}')">Bloquear</button>`, 'seen'),
+  allow: makeList('allow', 'tblAllow', [], d =>
+    `<button class="btn bad" onclick="delAllow('${d.mac}')">Eliminar</button><button class="btn out" onclick="toBlack('${d.mac}')">A Negra</button>`, 'mac'),
+  black: makeList('black', 'tblBlack', [], d =>
+    `<button class="btn bad" onclick="delBlack('${d.mac}')">Eliminar</button><button class="btn ok" onclick="toAllow('${d.mac}')">A Blanca</button>`, 'mac'),
+};
+
 const fetchState=async()=>{
   try{
-    const r=await fetch("/api/state?pass="+encodeURIComponent(PASS));
+    const r=await fetch("/api/state?lists=0&pass="+encodeURIComponent(PASS));
     const j=await r.json();
 
     document.getElementById('flt-status').innerText=j.filtering?'ACTIVO':'INACTIVO';
@@ -826,34 +2578,7 @@ const fetchState=async()=>{
     document.getElementById('ap-ssid-input').value = j.ap_ssid;
     document.getElementById('ap-pass-input').value = j.ap_pass;
 
-    const renderTable=(id, data, cols, actions)=>{
-      const tb=document.querySelector(`#${id} tbody`); tb.innerHTML='';
-      data.forEach(d=>{
-        const tr=document.createElement('tr');
-        const aliasHTML = `<span class="alias-text">${d.alias||''}</span> <button class="btn edit" onclick="openModal('${d.mac}', '${d.alias||''}')">✎</button>`;
-        let rowHTML = `<td><code>${d.mac}</code></td><td>${aliasHTML}</td>`;
-        if (cols.includes('seen')) rowHTML += `<td>${fmt(d.seen_ms)}</td>`;
-        if (cols.includes('aid')) rowHTML += `<td>${d.aid}</td>`;
-        if (cols.includes('rssi')) rowHTML += `<td>${d.rssi} dBm</td>`;
-        rowHTML += `<td>${actions(d)}</td>`;
-        tr.innerHTML = rowHTML;
-        tb.appendChild(tr);
-      });
-    }
-
-    renderTable('tblConn', j.connected, ['seen', 'aid', 'rssi'], d =>
-      `<button class="btn bad" onclick="deauth('${d.mac}')">Desautenticar</button>`
-    );
-    renderTable('tblPend', j.pending, ['seen'], d =>
-      `<button class="btn ok" onclick="approve('${d.mac}')">Aprobar</button><button class="btn bad" onclick="toBlack('${d.mac}')">Bloquear</button>`
-    );
-    renderTable('tblAllow', j.allowed, [], d =>
-      `<button class="btn bad" onclick="delAllow('${d.mac}')">Eliminar</button><button class="btn out" onclick="toBlack('${d.mac}')">A Negra</button>`
-    );
-    renderTable('tblBlack', j.black, [], d =>
-      `<button class="btn bad" onclick="delBlack('${d.mac}')">Eliminar</button><button class="btn ok" onclick="toAllow('${d.mac}')">A Blanca</button>`
-    );
-
+    Object.values(lists).forEach(l=>l.load());
   }catch(e){console.error("Error fetching state:",e)}
 }
 
@@ -876,6 +2601,23 @@ const fetchLog=async()=>{
   }catch(e){console.error("Error fetching log:",e)}
 }
 
+// Los SSID de las alertas los elige quien transmite: se escapan antes de insertarlos
+const esc=t=>String(t).replace(/[&<>"']/g,c=>'&#'+c.charCodeAt(0)+';');
+const ALERT_KINDS={impostor:'AP suplantador',security_change:'Cambio de seguridad',downgrade:'Seguridad degradada'};
+const fetchAlerts=async()=>{
+  try{
+    const r=await fetch("/api/alerts?pass="+encodeURIComponent(PASS));
+    const alerts=await r.json();
+    const cnt=document.getElementById('alert-count');
+    cnt.innerText=alerts.length?alerts.length:'OK';
+    cnt.className='status-indicator '+(alerts.length?'inactive':'active');
+    document.getElementById('alertLog').innerHTML=alerts.length?alerts.slice().reverse().map(a=>
+      `<div class="event-log-item"><span class="event-log-time">(${a.time})</span><span class="alert-kind">${ALERT_KINDS[a.kind]||a.kind}</span>`+
+      `'${esc(a.ssid)}' ${a.bssid} ${a.vendor?'('+esc(a.vendor)+') ':''}canal ${a.channel}, ${a.rssi} dBm, ${a.prev_security?a.prev_security+' → ':''}${a.security}</div>`).join(''):
+      '<div class="event-log-item">Sin APs sospechosos.</div>';
+  }catch(e){console.error("Error fetching alerts:",e)}
+}
+
 const openModal=(mac,alias)=>{
   modalMacInput.value=mac;
   modalAliasInput.value=alias||'';
@@ -907,6 +2649,7 @@ const setAPSettings=(ev)=>{
 }
 setInterval(fetchState,2000); fetchState();
 setInterval(fetchLog,2000); fetchLog();
+setInterval(fetchAlerts,5000); fetchAlerts();
 </script>
 </body></html>)rawliteral";
 }
@@ -915,6 +2658,487 @@ void handleAdmin(){
   server.send(200,"text/html", htmlAdmin());
 }
 
+#if ENABLE_BENCH || ENABLE_STORM
+// Copia de las tablas en RAM para las herramientas de diagnóstico que las ensucian
+struct TableSnapshot {
+  MacList* allow = nullptr;
+  MacList* black = nullptr;
+  ConnectedTable* conn = nullptr;
+  PendingTable* pend = nullptr;
+  LogRing* log = nullptr;
+  FixedVec<Offender, MAX_OFFENDERS>* offs = nullptr;
+  FixedVec<ClientHistory, MAX_HISTORY>* hist = nullptr;
+  RogueState* rog = nullptr;
+  FixedRing<RogueAlert, MAX_ROGUE_ALERTS>* alerts = nullptr;
+  bool newPending = false;
+  void save(){
+    allow = new MacList(allowList);
+    black = new MacList(blackList);
+    conn  = new ConnectedTable(connected);
+    pend  = new PendingTable(pending);
+    log   = new LogRing(eventLog);
+    offs  = new FixedVec<Offender, MAX_OFFENDERS>(offenders);
+    hist  = new FixedVec<ClientHistory, MAX_HISTORY>(history);
+    rog   = new RogueState(rogue);
+    alerts = new FixedRing<RogueAlert, MAX_ROGUE_ALERTS>(rogueAlerts);
+    newPending = isNewPending;
+  }
+  void restore(){
+    allowList = *allow; blackList = *black;
+    connected = *conn;  pending = *pend;
+    eventLog  = *log;  offenders = *offs;  history = *hist;
+    rogue = *rog;      rogueAlerts = *alerts;
+    isNewPending = newPending;
+    aclDirty = true; viewDirty = 0xFF;
+    delete allow; delete black; delete conn; delete pend; delete log; delete offs; delete hist; delete rog; delete alerts;
+    allow = black = nullptr; conn = nullptr; pend = nullptr; log = nullptr; offs = nullptr; hist = nullptr; rog = nullptr; alerts = nullptr;
+  }
+};
+#endif
+
+#if ENABLE_BENCH
+// ====== Benchmark de rutas calientes ======
+// GET /api/bench?pass=...&n=1000  -> corre todos los casos con una población sintética de n MACs
+// (sin n: barre 10, 100, 1000 y 10000). Los casos que usan tablas reales (estado, log, espera)
+// se recortan a la capacidad de la tabla y el estado real se restaura al terminar.
+// Presupuesto por caso: base_ns + item_ns*n; si se excede se marca "ok":false y se registra en el log.
+struct BenchResult {
+  const char* name;
+  uint32_t n;         // tamaño efectivo de la población
+  uint32_t ops;
+  uint32_t nsPerOp;
+  int32_t heapPerOp;  // bytes retenidos por operación (fugas)
+  int32_t blocksPerOp;// bloques de heap netos por operación
+  uint32_t minFree;   // mínimo histórico de heap libre tras el caso
+  uint32_t budgetNs;
+  bool ok;
+};
+
+struct BenchMeter {
+  multi_heap_info_t h0;
+  int32_t heapDelta = 0, blocksDelta = 0; // totales de la corrida (válidos tras stop)
+  uint32_t c0 = 0, cycles = 0;
+  bool running = false;
+  void start(){ heap_caps_get_info(&h0, MALLOC_CAP_8BIT); cycles = 0; resume(); }
+  void resume(){ running = true; c0 = ESP.getCycleCount(); }
+  void pause(){ if (running){ cycles += ESP.getCycleCount() - c0; running = false; } }
+  void stop(BenchResult &r){
+    pause();
+    multi_heap_info_t h1; heap_caps_get_info(&h1, MALLOC_CAP_8BIT);
+    uint32_t ops = r.ops ? r.ops : 1;
+    r.nsPerOp    = (uint32_t)(((uint64_t)cycles * 1000ULL) / ESP.getCpuFreqMHz() / ops);
+    heapDelta    = (int32_t)h1.total_allocated_bytes - (int32_t)h0.total_allocated_bytes;
+    blocksDelta  = (int32_t)h1.allocated_blocks - (int32_t)h0.allocated_blocks;
+    r.heapPerOp  = heapDelta / (int32_t)ops;
+    r.blocksPerOp= blocksDelta / (int32_t)ops;
+    r.minFree    = ESP.getMinFreeHeap();
+    r.ok         = r.nsPerOp <= r.budgetNs;
+  }
+};
+
+MacStr benchMac(uint32_t i){
+  uint8_t m[6] = {0x02, 0xBE, (uint8_t)(i>>24), (uint8_t)(i>>16), (uint8_t)(i>>8), (uint8_t)i};
+  return macFromBytes(m);
+}
+
+BenchResult benchMacInList(uint32_t n){
+  // La población sintética excede MAX_MACS: se arma en el heap, limitada a la mitad del mayor bloque
+  // libre para que WiFi, lwIP y la propia respuesta HTTP sigan teniendo memoria
+  uint32_t fit = ESP.getMaxAllocHeap() / 2 / sizeof(MacStr);
+  if (n > fit) n = fit;
+  BenchResult r = {"mac_in_list", n, 200, 0, 0, 0, 0, 2000 + 100*n, false};
+  MacStr* list = new MacStr[n];
+  for (uint32_t i=0;i<n;i++) list[i] = benchMac(i);
+  MacStr hit = benchMac(n ? n-1 : 0), miss = benchMac(0xFFFFFF);
+  BenchMeter bm; bm.start();
+  volatile int found = 0;
+  for (uint32_t k=0;k<r.ops;k++) found += macInList(((k&1)? miss : hit).c_str(), list, n);
+  bm.stop(r);
+  delete[] list;
+  return r;
+}
+
+BenchResult benchAclDecide(uint32_t n){
+  // Listas llenas con mezcla de longitudes: el costo no debe depender de n
+  uint32_t nl = n < (uint32_t)MAX_MACS ? n : MAX_MACS;
+  allowList.clear(); blackList.clear();
+  static const char* suf[] = {"", "/36", "/28", "/24"};
+  for (uint32_t i=0;i<nl;i++){
+    String rule; normalizeRule(String(benchMac(i).c_str()) + suf[i & 3], rule);
+    allowList.push(MacStr(rule)); blackList.push(benchMac(0x10000+i));
+  }
+  aclDirty = true; viewDirty = 0xFF;
+  BenchResult r = {"acl_decide", nl, 1000, 0, 0, 0, 0, 5000, false};
+  uint64_t hit = macStrToU64(benchMac(nl ? nl-1 : 0).c_str()), miss = 0x0257FFFFFFFFULL;
+  aclDecide(hit); // compila el índice fuera de la medición
+  BenchMeter bm; bm.start();
+  volatile int v = 0;
+  for (uint32_t k=0;k<r.ops;k++) v += aclDecide((k&1)? miss : hit);
+  bm.stop(r);
+  return r;
+}
+
+BenchResult benchRogueCheck(uint32_t n){
+  // n resultados de escaneo ya conocidos (el caso de cada ciclo): costo por resultado constante
+  uint32_t na = n < (uint32_t)ROGUE_MAX_APS ? n : ROGUE_MAX_APS;
+  // Campo por campo: 'rogue = {}' armaría un RogueState temporal de varios KB en la pila
+  rogue.aps.clear(); rogue.ssids.clear();
+  memset(rogue.apIdx, 0, sizeof(rogue.apIdx)); memset(rogue.ssidIdx, 0, sizeof(rogue.ssidIdx));
+  rogue.scans = ROGUE_LEARN_SCANS;
+  static wifi_ap_record_t recs[ROGUE_MAX_APS];
+  for (uint32_t i=0;i<na;i++){
+    uint64_t m = macStrToU64(benchMac(i).c_str());
+    for (int b=0;b<6;b++) recs[i].bssid[b] = m >> (8*(5-b));
+    snprintf((char*)recs[i].ssid, sizeof(recs[i].ssid), "bench-%u", (unsigned)(i % ROGUE_MAX_SSIDS));
+    recs[i].primary = 1 + i % 11; recs[i].rssi = -60; recs[i].authmode = WIFI_AUTH_WPA2_PSK;
+    rogueCheck(&recs[i]);
+  }
+  BenchResult r = {"rogue_check", na, 1000, 0, 0, 0, 0, 5000, false};
+  BenchMeter bm; bm.start();
+  for (uint32_t k=0;k<r.ops;k++) rogueCheck(&recs[na ? k % na : 0]);
+  bm.stop(r);
+  return r;
+}
+
+BenchResult benchNormalizeMac(uint32_t n){
+  static const char* inputs[] = {"aa:bb:cc:dd:ee:ff", "AA-BB-CC-DD-EE-FF", "aabb.ccdd.eeff", " aa bb cc dd ee ff ", "zz:zz"};
+  BenchResult r = {"normalize_mac", n, n, 0, 0, 0, 0, 30000, false};
+  String out;
+  BenchMeter bm; bm.start();
+  for (uint32_t k=0;k<r.ops;k++) normalizeMac(inputs[k % 5], out);
+  bm.stop(r);
+  return r;
+}
+
+uint32_t benchFillTables(uint32_t n){
+  uint32_t nl = n < (uint32_t)MAX_MACS ? n : MAX_MACS;
+  uint32_t nc = n < (uint32_t)MAX_CONNECTED ? n : MAX_CONNECTED;
+  uint32_t np = n < (uint32_t)MAX_PENDING ? n : MAX_PENDING;
+  allowList.clear(); blackList.clear(); connected.clear(); pending.clear();
+  for (uint32_t i=0;i<nl;i++){ allowList.push(benchMac(i)); blackList.push(benchMac(0x10000+i)); }
+  for (uint32_t i=0;i<nc;i++) connected.push({benchMac(0x20000+i), "bench", millis(), (uint16_t)(i+1), -60});
+  for (uint32_t i=0;i<np;i++) pending.push({benchMac(0x30000+i), "", millis(), (uint16_t)(i+1), 0});
+  viewDirty = 0xFF;
+  return 2*nl + nc + np;
+}
+
+BenchResult benchStateJson(uint32_t n){
+  uint32_t items = benchFillTables(n);
+  BenchResult r = {"state_json", items, 5, 0, 0, 0, 0, 5000000 + 150000*items, false};
+  BenchMeter bm; bm.start();
+  volatile uint32_t len = 0;
+  for (uint32_t k=0;k<r.ops;k++) len += buildStateJson().length();
+  bm.stop(r);
+  return r;
+}
+
+void countSink(void* ctx, const uint8_t*, size_t n){ *(size_t*)ctx += n; }
+BenchResult benchStateCbor(uint32_t n){
+  uint32_t items = benchFillTables(n);
+  BenchResult r = {"state_cbor", items, 5, 0, 0, 0, 0, 5000000 + 150000*items, false};
+  BenchMeter bm; bm.start();
+  size_t bytes = 0;
+  for (uint32_t k=0;k<r.ops;k++){ Emitter e(true, countSink, &bytes); emitState(e); e.flush(); }
+  bm.stop(r);
+  return r;
+}
+
+BenchResult benchLogEvent(uint32_t n){
+  MacStr m = benchMac(1);
+  while (eventLog.size() < MAX_LOG_EVENTS) logEventf("Relleno %s", m.c_str()); // log lleno: se sobrescribe
+  BenchResult r = {"log_event", (uint32_t)MAX_LOG_EVENTS, n, 0, 0, 0, 0, 20000, false};
+  BenchMeter bm; bm.start();
+  for (uint32_t k=0;k<r.ops;k++) logEventf("Nuevo dispositivo %s intentó conectarse y fue enviado a la lista de espera.", m.c_str());
+  bm.stop(r);
+  return r;
+}
+
+BenchResult benchPrunePending(uint32_t n){
+  BenchResult r = {"prune_pending", (uint32_t)MAX_PENDING, 0, 0, 0, 0, 0, 2000 + 300*MAX_PENDING, false};
+  uint32_t now = millis();
+  // La tabla se rellena antes de cada pasada (la mitad expirada) y sólo se cronometra la poda
+  r.ops = n < 50 ? (n ? n : 1) : 50;
+  BenchMeter bm; bm.start(); bm.pause();
+  for (uint32_t k=0;k<r.ops;k++){
+    pending.clear();
+    for (int i=0;i<MAX_PENDING;i++)
+      pending.push({benchMac(0x40000+i), "", (i&1)? now : now - PENDING_TTL_MS - 1000, (uint16_t)(i+1), 0});
+    bm.resume();
+    prunePending();
+    bm.pause();
+  }
+  bm.stop(r);
+  return r;
+}
+
+// Régimen estable de la ruta de gating: el ciclo completo de un cliente (espera con lectura de
+// alias, reintento, aprobación, conexión, RSSI, desconexión, log y poda) no debe dejar ni un byte
+// ni un bloque nuevo en el heap. "ok" depende sólo de eso, no del tiempo.
+BenchResult benchSteadyState(uint32_t n){
+  BenchResult r = {"steady_state", (uint32_t)MAX_PENDING, n < 200 ? (n ? n : 1) : 200, 0, 0, 0, 0, 0, false};
+  pending.clear(); connected.clear();
+  auto cycle = [](uint32_t k){
+    MacStr m = benchMac(0x50000 + (k % MAX_PENDING));
+    addOrUpdatePending(m.c_str(), 1);
+    addOrUpdatePending(m.c_str(), 1);
+    logEventf("Nuevo dispositivo %s intentó conectarse y fue enviado a la lista de espera.", m.c_str());
+    removePending(m.c_str());
+    addOrUpdateConnected(m.c_str(), 2);
+    refreshRSSIConnected();
+    logEventf("MAC %s se ha desconectado.", m.c_str());
+    removeConnected(m.c_str());
+    prunePending();
+  };
+  cycle(0); // calentamiento: NVS abre sus cachés la primera vez
+  BenchMeter bm; bm.start();
+  for (uint32_t k=0;k<r.ops;k++) cycle(k);
+  bm.stop(r);
+  r.budgetNs = r.nsPerOp;
+  r.ok = (bm.heapDelta == 0 && bm.blocksDelta == 0);
+  return r;
+}
+
+void benchResultJson(String& j, const BenchResult& r){
+  j += "{\"name\":\""; j += r.name;
+  j += "\",\"n\":"; j += String(r.n);
+  j += ",\"ops\":"; j += String(r.ops);
+  j += ",\"ns_op\":"; j += String(r.nsPerOp);
+  j += ",\"heap_op\":"; j += String(r.heapPerOp);
+  j += ",\"blocks_op\":"; j += String(r.blocksPerOp);
+  j += ",\"min_free\":"; j += String(r.minFree);
+  j += ",\"budget_ns\":"; j += String(r.budgetNs);
+  j += ",\"ok\":"; j += (r.ok ? "true" : "false");
+  j += "}";
+}
+
+void handleApiBench(){
+  if (guardLists()) return;
+  if (eventHold != HOLD_NONE){ server.send(409, "text/plain", "Ya hay una corrida en curso"); return; }
+  static const uint32_t sizes[] = {10, 100, 1000, 10000};
+  uint32_t one = server.hasArg("n") ? (uint32_t)server.arg("n").toInt() : 0;
+
+  // Los casos reescriben las tablas reales, listas incluidas; se restauran al final. Mientras tanto los
+  // eventos reales se retienen enteros (HOLD_ALL: la ACL tampoco es la real) y se reprocesan después.
+  holdEvents(HOLD_ALL);
+  TableSnapshot snap; snap.save();
+
+  String j; j.reserve(4096);
+  j += "{\"cpu_mhz\":"; j += String(ESP.getCpuFreqMHz());
+  j += ",\"cases\":[";
+  bool allOk = true, first = true;
+  for (uint32_t s=0;s<4;s++){
+    uint32_t n = one ? one : sizes[s];
+    BenchResult rs[] = { benchMacInList(n), benchAclDecide(n), benchRogueCheck(n), benchNormalizeMac(n), benchStateJson(n), benchStateCbor(n), benchLogEvent(n), benchPrunePending(n),
+                         benchSteadyState(n) };
+    for (const BenchResult& r : rs){
+      if (!first) j += ','; first = false;
+      benchResultJson(j, r);
+      if (!r.ok){ allOk = false; Serial.printf("[BENCH] %s n=%u fuera de presupuesto: %u ns/op, %d B/op\n", r.name, r.n, r.nsPerOp, r.heapPerOp); }
+    }
+    if (one) break;
+  }
+  j += "],\"ok\":"; j += (allOk ? "true" : "false");
+  j += "}";
+
+  snap.restore();
+  releaseEvents();
+  if (!allOk) logEvent("Benchmark: hay casos fuera de presupuesto (ver /api/bench).");
+  server.send(200, "application/json", j);
+}
+#endif
+
+#if ENABLE_STORM
+// ====== Generador de ráfagas de asociación ======
+// GET  /api/storm/start?pass=...&n=60&rate=200&repeat=1 -> n estaciones sintéticas conectándose a 'rate' ev/s
+// POST /api/storm/start?pass=...[&rate=...]            -> traza grabada en el cuerpo, una línea por evento:
+//      <ms> <C|D> <MAC> [aid]     (sin rate se respetan los tiempos de la traza)
+// GET  /api/storm?pass=...                              -> estado y resultados de la última corrida
+// Los eventos se encolan según su tiempo y loop() los drena hacia handleStaEvent(..., quiet=true), que
+// no desautentica estaciones reales. Las tablas se restauran al terminar y queda una línea de resumen en
+// el log. Durante la corrida las asociaciones reales se deciden contra la ACL al llegar y sólo su
+// contabilidad se retiene (HOLD_TABLES) hasta después de restaurar. La corrida dura como mucho
+// STORM_MAX_RUN_MS: lo que quede de la traza se cuenta como descartado.
+static const int STORM_MAX_EVENTS   = 512;
+static const int STORM_QUEUE_LEN    = 32;   // como la cola de eventos del core
+static const uint32_t STORM_DRAIN_BUDGET_US = 5000; // tiempo máximo de drenado por iteración de loop()
+static const uint32_t STORM_MAX_RUN_MS = 60000;     // tope de la retención de eventos reales
+
+struct StormEvent {
+  uint32_t atMs;
+  uint8_t mac[6];
+  uint8_t aid;
+  bool connect;
+};
+StormEvent stormTrace[STORM_MAX_EVENTS]; int stormTraceCount = 0;
+int stormQueue[STORM_QUEUE_LEN];         int stormQHead = 0, stormQCount = 0;
+uint32_t stormQueuedAt[STORM_QUEUE_LEN];
+
+struct StormStats {
+  bool running;
+  uint32_t startMs, endMs;
+  int next;                     // siguiente evento de la traza a encolar
+  uint32_t dropped;
+  uint32_t maxDepth;
+  LatencyHist lat;              // tiempo dentro de WiFiEventHandler
+  uint32_t waitMaxUs;           // tiempo en cola
+  uint32_t heapMin, heapStart;
+};
+StormStats storm = {};
+TableSnapshot stormSnap;
+
+bool parseMacBytes(const String& in, uint8_t* out){
+  String n; if (!normalizeMac(in, n)) return false;
+  for (int i=0;i<6;i++) out[i] = (uint8_t)strtoul(n.substring(i*3, i*3+2).c_str(), nullptr, 16);
+  return true;
+}
+
+void stormStart(){
+  storm = {};
+  storm.running = true;
+  storm.startMs = millis();
+  storm.heapStart = storm.heapMin = ESP.getFreeHeap();
+  stormQHead = stormQCount = 0;
+  stormSnap.save();
+  holdEvents(HOLD_TABLES);
+}
+
+void stormFinish(){
+  storm.running = false;
+  storm.endMs = millis();
+  stormSnap.restore();
+  releaseEvents();
+  logEvent("Storm: " + String(storm.lat.count) + " eventos, " + String(storm.dropped) + " descartados, max " +
+           String(storm.lat.maxUs) + " us.");
+}
+
+void stormInject(const StormEvent& e){
+  WiFiEventInfo_t info; memset(&info, 0, sizeof(info));
+  WiFiEvent_t ev;
+  if (e.connect){
+    ev = ARDUINO_EVENT_WIFI_AP_STACONNECTED;
+    memcpy(info.wifi_ap_staconnected.mac, e.mac, 6);
+    info.wifi_ap_staconnected.aid = e.aid;
+  } else {
+    ev = ARDUINO_EVENT_WIFI_AP_STADISCONNECTED;
+    memcpy(info.wifi_ap_stadisconnected.mac, e.mac, 6);
+    info.wifi_ap_stadisconnected.aid = e.aid;
+  }
+  handleStaEvent(ev, info, true);
+}
+
+void stormTick(){
+  if (!storm.running) return;
+  uint32_t elapsed = millis() - storm.startMs;
+  if (elapsed > STORM_MAX_RUN_MS){
+    storm.dropped += (stormTraceCount - storm.next) + stormQCount;
+    storm.next = stormTraceCount; stormQCount = 0;
+    stormFinish();
+    return;
+  }
+
+  // Productor: encola todo lo que ya venció; con la cola llena el evento se pierde
+  while (storm.next < stormTraceCount && stormTrace[storm.next].atMs <= elapsed){
+    if (stormQCount >= STORM_QUEUE_LEN) storm.dropped++;
+    else {
+      int slot = (stormQHead + stormQCount) % STORM_QUEUE_LEN;
+      stormQueue[slot] = storm.next;
+      stormQueuedAt[slot] = micros();
+      stormQCount++;
+      if ((uint32_t)stormQCount > storm.maxDepth) storm.maxDepth = stormQCount;
+    }
+    storm.next++;
+  }
+
+  // Consumidor: drena con presupuesto de tiempo para no acaparar loop()
+  uint32_t t0 = micros();
+  while (stormQCount > 0 && micros() - t0 < STORM_DRAIN_BUDGET_US){
+    int slot = stormQHead;
+    stormQHead = (stormQHead + 1) % STORM_QUEUE_LEN; stormQCount--;
+    uint32_t s = micros();
+    uint32_t wait = s - stormQueuedAt[slot];
+    stormInject(stormTrace[stormQueue[slot]]);
+    histObserve(storm.lat, micros() - s);
+    if (wait > storm.waitMaxUs) storm.waitMaxUs = wait;
+  }
+  uint32_t freeNow = ESP.getFreeHeap();
+  if (freeNow < storm.heapMin) storm.heapMin = freeNow;
+
+  if (storm.next >= stormTraceCount && stormQCount == 0) stormFinish();
+}
+
+void handleStormStart(){
+  if (guardLists()) return; // antes de cargar las listas los eventos reales ya están retenidos
+  if (eventHold != HOLD_NONE){ server.send(409, "text/plain", "Ya hay una corrida en curso"); return; }
+  uint32_t rate = server.hasArg("rate") ? (uint32_t)server.arg("rate").toInt() : 0;
+  stormTraceCount = 0;
+
+  if (server.hasArg("plain")){
+    // Traza grabada
+    String body = server.arg("plain");
+    int start = 0;
+    while (start < (int)body.length() && stormTraceCount < STORM_MAX_EVENTS){
+      int nl = body.indexOf('\n', start);
+      String line = (nl == -1) ? body.substring(start) : body.substring(start, nl);
+      start = (nl == -1) ? body.length() : nl + 1;
+      line.trim();
+      if (!line.length() || line[0] == '#') continue;
+      int a = line.indexOf(' '), b = (a < 0) ? -1 : line.indexOf(' ', a + 1);
+      if (a < 0 || b < 0){ server.send(400, "text/plain", "Linea invalida: " + line); return; }
+      int c = line.indexOf(' ', b + 1);
+      StormEvent &e = stormTrace[stormTraceCount];
+      e.atMs = (uint32_t)line.substring(0, a).toInt();
+      e.connect = (line[a + 1] == 'C' || line[a + 1] == 'c');
+      if (!parseMacBytes(c < 0 ? line.substring(b + 1) : line.substring(b + 1, c), e.mac)){
+        server.send(400, "text/plain", "MAC invalida: " + line); return;
+      }
+      e.aid = (c < 0) ? (uint8_t)(stormTraceCount % 250 + 1) : (uint8_t)line.substring(c + 1).toInt();
+      stormTraceCount++;
+    }
+    if (rate) for (int i=0;i<stormTraceCount;i++) stormTrace[i].atMs = (uint32_t)((uint64_t)i * 1000 / rate);
+  } else {
+    // Ráfaga sintética: n estaciones desconocidas, 'repeat' intentos cada una (reconexiones)
+    int n = server.hasArg("n") ? server.arg("n").toInt() : 60;
+    int repeat = server.hasArg("repeat") ? server.arg("repeat").toInt() : 1;
+    if (!rate) rate = 200;
+    for (int r=0;r<repeat;r++){
+      for (int i=0;i<n && stormTraceCount < STORM_MAX_EVENTS;i++){
+        StormEvent &e = stormTrace[stormTraceCount];
+        e.atMs = (uint32_t)((uint64_t)stormTraceCount * 1000 / rate);
+        e.mac[0] = 0x02; e.mac[1] = 0x57; e.mac[2] = 0x0A; e.mac[3] = 0x00;
+        e.mac[4] = (uint8_t)(i >> 8); e.mac[5] = (uint8_t)i;
+        e.aid = (uint8_t)(i % 250 + 1);
+        e.connect = true;
+        stormTraceCount++;
+      }
+    }
+  }
+  if (!stormTraceCount){ server.send(400, "text/plain", "Traza vacia"); return; }
+  stormStart();
+  server.send(200, "text/plain", "OK " + String(stormTraceCount) + " eventos");
+}
+
+void handleStormStatus(){
+  if (guard()) return;
+  uint32_t dur = (storm.running ? millis() : storm.endMs) - storm.startMs;
+  String j; j.reserve(512);
+  j += "{\"running\":"; j += (storm.running ? "true" : "false");
+  j += ",\"events\":"; j += String(stormTraceCount);
+  j += ",\"handled\":"; j += String(storm.lat.count);
+  j += ",\"dropped\":"; j += String(storm.dropped);
+  j += ",\"duration_ms\":"; j += String(dur);
+  j += ",\"max_queue\":"; j += String(storm.maxDepth);
+  j += ",\"lat_avg_us\":"; j += String(storm.lat.count ? (uint32_t)(storm.lat.sumUs / storm.lat.count) : 0);
+  j += ",\"lat_max_us\":"; j += String(storm.lat.maxUs);
+  j += ",\"wait_max_us\":"; j += String(storm.waitMaxUs);
+  j += ",\"lat_hist\":[";
+  for (int i=0;i<HIST_BUCKETS;i++){ if (i) j += ','; j += String(storm.lat.buckets[i]); }
+  j += "],\"heap_start\":"; j += String(storm.heapStart);
+  j += ",\"heap_min\":"; j += String(storm.heapMin);
+  j += "}";
+  server.send(200, "application/json", j);
+}
+#endif
+
 // Sniffer callback
 void sniffer(void* buf, wifi_promiscuous_pkt_type_t type) {
   // Aquí puedes agregar tu lógica de análisis de paquetes
@@ -923,35 +3147,129 @@ void sniffer(void* buf, wifi_promiscuous_pkt_type_t type) {
   // Serial.printf("Tipo: %d, Tamaño: %d\n", type, ((wifi_promiscuous_pkt_t*)buf)->rx_ctrl.sig_len);
 }
 
-// ====== Setup / Loop ======
-void setup(){
-  Serial.begin(115200);
-  delay(200);
+#if ENABLE_TRACE
+String traceTagName(uint16_t tag){
+  switch (tag){
+    case TR_HANDLE_CLIENT: return "handleClient";
+    case TR_DNS:           return "dns";
+    case TR_RUN_SCAN:      return "scanCollect";
+    case TR_RSSI:          return "refreshRSSIConnected";
+    case TR_PRUNE:         return "prunePending";
+    case TR_NVS_READ:      return "nvs_read";
+    case TR_NVS_WRITE:     return "nvs_write";
+    case TR_WIFI_EVENT:    return "handleStaEvent";
+  }
+  if (tag >= TR_ROUTE_BASE && tag - TR_ROUTE_BASE < routeCount) return routeMetrics[tag - TR_ROUTE_BASE].path;
+  return "tag" + String(tag);
+}
+
+void handleApiTrace(){
+  if (guard()) return;
+  // Copia del anillo (más antiguo primero) para no bloquear a los productores mientras se envía
+  TraceRec* recs = new TraceRec[TRACE_CAPACITY];
+  portENTER_CRITICAL(&traceMux);
+  uint32_t n = traceCount;
+  uint32_t first = (traceHead + TRACE_CAPACITY - n) % TRACE_CAPACITY;
+  for (uint32_t i=0;i<n;i++) recs[i] = traceRing[(first + i) % TRACE_CAPACITY];
+  if (server.hasArg("clear")) traceCount = 0;
+  portEXIT_CRITICAL(&traceMux);
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  if (server.arg("fmt") == "json"){
+    server.send(200, "application/json", "");
+    String chunk; chunk.reserve(1600);
+    chunk += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    uint64_t ts = 0;
+    for (uint32_t i=0;i<n;i++){
+      if (i) ts += (uint32_t)(recs[i].tsUs - recs[i-1].tsUs); // tolera el desborde de micros()
+      if (i) chunk += ',';
+      chunk += "{\"name\":\""; chunk += traceTagName(recs[i].tag);
+      chunk += "\",\"ph\":\""; chunk += (char)recs[i].phase;
+      chunk += "\",\"ts\":"; chunk += String((uint32_t)ts);
+      chunk += ",\"pid\":1,\"tid\":"; chunk += String(recs[i].tid);
+      chunk += "}";
+      if (chunk.length() > 1400){ server.sendContent(chunk); chunk = ""; }
+    }
+    chunk += "]}";
+    server.sendContent(chunk);
+  } else {
+    server.send(200, "application/octet-stream", "");
+    uint8_t hdr[8] = {'E','S','T','R', 1, 0, (uint8_t)n, (uint8_t)(n >> 8)};
+    server.sendContent((const char*)hdr, sizeof(hdr));
+    for (uint32_t i=0;i<n;i+=128)
+      server.sendContent((const char*)&recs[i], (n - i < 128 ? n - i : 128) * sizeof(TraceRec));
+    // Tabla de nombres: [tag u16][len u8][nombre] ... para convertir fuera del equipo
+    uint8_t names[1024]; size_t len = 0;
+    for (uint16_t tag=TR_HANDLE_CLIENT; tag < TR_ROUTE_BASE + routeCount; tag++){
+      if (tag > TR_WIFI_EVENT && tag < TR_ROUTE_BASE) continue;
+      String nm = traceTagName(tag);
+      if (len + 3 + nm.length() > sizeof(names)) break;
+      names[len++] = tag & 0xFF; names[len++] = tag >> 8; names[len++] = nm.length();
+      memcpy(names + len, nm.c_str(), nm.length()); len += nm.length();
+    }
+    server.sendContent((const char*)names, len);
+  }
+  server.sendContent("");
+  delete[] recs;
+}
+#endif
 
-  // LittleFS
-  if(!LittleFS.begin(true)){
-    Serial.println("An Error has occurred while mounting LittleFS");
+// Registra una ruta midiendo la latencia de su handler
+void route(const char* path, HTTPMethod method, void (*fn)()){
+  if (routeCount >= MAX_ROUTES){
+    if (strchr(path, '{')) server.on(UriBraces(path), method, fn); else server.on(path, method, fn);
     return;
   }
+  int idx = routeCount++;
+  routeMetrics[idx].path = path;
+  auto wrapped = [idx, fn](){
+    TRACE_SCOPE(TR_ROUTE_BASE + idx);
+    uint32_t t0 = micros();
+    fn();
+    histObserve(routeMetrics[idx].h, micros() - t0);
+    bootMark(BOOT_FIRST_REQUEST);
+  };
+  if (strchr(path, '{')) server.on(UriBraces(path), method, wrapped); // "/api/list/{}" -> pathArg(0)
+  else server.on(path, method, wrapped);
+}
 
-  // Listas desde NVS
+// ====== Setup / Loop ======
+// Arranque por etapas. setup() sólo hace lo necesario para atender clientes (config del AP, AP, DNS,
+// HTTP); el resto corre después como trabajos de una sola vez del planificador, entre peticiones.
+void bootMountFs(){
+  if(!LittleFS.begin(true)) Serial.println("An Error has occurred while mounting LittleFS");
+  bootMark(BOOT_FS);
+}
+
+void bootLoadLists(){
   loadListsFromNVS();
   aliasPrefs.begin("mac_alias", false); // Initialize alias preferences
   aliasPrefs.end();
 
-  loadAPConfigFromNVS();
-
   // Forzar agregar tu laptop en BLANCA si no está
   String my; normalizeMac(String(MY_LAPTOP_MAC), my);
-  if (my.length()==17 && !macAllowed(my)) { 
-    addMacAllow(my); 
-    saveAliasToNVS(my, "Mi Laptop"); // Set a default alias
+  if (my.length()==17 && !macAllowed(my.c_str())) { 
+    addMacAllow(my.c_str()); 
+    saveAliasToNVS(my.c_str(), "Mi Laptop"); // Set a default alias
     saveAllowToNVS(); 
     logEvent("MAC " + my + " agregada a la lista blanca por defecto.");
   }
-  
-  logEvent("Sistema iniciado.");
-  
+
+  // Desde aquí los eventos se atienden directo; se reprocesan los que llegaron durante la carga
+  listsReady = true;
+  releaseEvents();
+  bootMark(BOOT_LISTS);
+  logEventf("Sistema iniciado (HTTP en %u ms, listas en %u ms).", bootUs[BOOT_HTTP] / 1000, bootUs[BOOT_LISTS] / 1000);
+}
+
+void setup(){
+  Serial.begin(115200);
+
+  // Etapa 1: config del AP desde NVS (un blob) y red arriba
+  loadAPConfigFromNVS();
+  rogueInit();
+  bootMark(BOOT_CONFIG);
+
   // Corregir modo de WiFi
   WiFi.mode(WIFI_AP);
   WiFi.onEvent(WiFiEventHandler);
@@ -962,48 +3280,81 @@ void setup(){
   
   // Configurar sniffer callback
   esp_wifi_set_promiscuous_rx_cb(&sniffer);
-
-  runScan();
-  lastScan = millis();
+  bootMark(BOOT_AP);
 
   // Rutas Scanner
-  server.on("/", HTTP_GET, handleRoot);
-  server.on("/api/scan", HTTP_GET, handleApiScan);
-  server.on("/api/rescan", HTTP_GET, handleRescan);
+  route("/", HTTP_GET, handleRoot);
+  route("/api/scan", HTTP_GET, handleApiScan);
+  route("/api/schema", HTTP_GET, handleApiSchema);
+  route("/api/rescan", HTTP_GET, handleRescan);
 
   // Rutas Admin
-  server.on("/admin", HTTP_GET, handleAdmin);
-  server.on("/api/state", HTTP_GET, handleApiState);
-  server.on("/api/log", HTTP_GET, handleApiLog);
-  server.on("/add", HTTP_GET, handleAddAllow);
-  server.on("/del", HTTP_GET, handleDelAllow);
-  server.on("/approve", HTTP_GET, handleApprove);
-  server.on("/addb", HTTP_GET, handleAddBlack);
-  server.on("/delb", HTTP_GET, handleDelBlack);
-  server.on("/to_black", HTTP_GET, handleToBlack);
-  server.on("/to_allow", HTTP_GET, handleToAllow);
-  server.on("/set_alias", HTTP_GET, handleAddAlias);
-  server.on("/deauth", HTTP_GET, handleDeauth);
-  server.on("/start_evil_twin", HTTP_GET, handleEvilTwin);
-  server.on("/stop_evil_twin", HTTP_GET, handleStopEvilTwin);
-  server.on("/start_sniffer", HTTP_GET, handleStartSniffer);
-  server.on("/stop_sniffer", HTTP_GET, handleStopSniffer);
-  server.on("/set_ap_settings", HTTP_GET, handleSetAPSettings);
+  route("/admin", HTTP_GET, handleAdmin);
+  route("/api/state", HTTP_GET, handleApiState);
+  route("/api/list/{}", HTTP_GET, handleApiList);
+  route("/api/history", HTTP_GET, handleApiHistory);
+  route("/api/log", HTTP_GET, handleApiLog);
+  route("/api/alerts", HTTP_GET, handleApiAlerts);
+  route("/add", HTTP_GET, handleAddAllow);
+  route("/del", HTTP_GET, handleDelAllow);
+  route("/approve", HTTP_GET, handleApprove);
+  route("/addb", HTTP_GET, handleAddBlack);
+  route("/delb", HTTP_GET, handleDelBlack);
+  route("/to_black", HTTP_GET, handleToBlack);
+  route("/to_allow", HTTP_GET, handleToAllow);
+  route("/set_alias", HTTP_GET, handleAddAlias);
+  route("/deauth", HTTP_GET, handleDeauth);
+  route("/start_evil_twin", HTTP_GET, handleEvilTwin);
+  route("/stop_evil_twin", HTTP_GET, handleStopEvilTwin);
+  route("/start_sniffer", HTTP_GET, handleStartSniffer);
+  route("/stop_sniffer", HTTP_GET, handleStopSniffer);
+  route("/set_ap_settings", HTTP_GET, handleSetAPSettings);
+  route("/metrics", HTTP_GET, handleMetrics);
+#if ENABLE_BENCH
+  route("/api/bench", HTTP_GET, handleApiBench);
+#endif
+#if ENABLE_TRACE
+  route("/api/trace", HTTP_GET, handleApiTrace);
+#endif
+#if ENABLE_STORM
+  route("/api/storm", HTTP_GET, handleStormStatus);
+  route("/api/storm/start", HTTP_ANY, handleStormStart);
+#endif
 
+  static const char* headerKeys[] = {"If-None-Match", "Accept-Encoding", "Accept"};
+  server.collectHeaders(headerKeys, 3);
   server.begin();
+  bootMark(BOOT_HTTP);
   Serial.println("[HTTP] Servidor listo en http://192.168.4.1");
+
+  // Etapa 2: en segundo plano. Mientras tanto /api/scan responde "[]" y los cambios de listas, 503.
+  schedOnce("lists", bootLoadLists, 0, 50000, 0);
+  schedOnce("fs", bootMountFs, 0, 50000, 1);
+
+  // Trabajos periódicos (fases desfasadas para que no coincidan en la misma iteración)
+  scanJob = schedEvery("scan", runScan, SCAN_INTERVAL_MS, 500, 5000, 2);
+  schedEvery("rssi", refreshRSSIConnected, RSSI_INTERVAL_MS, 300, 2000, 1);
+  schedEvery("prune", prunePending, PRUNE_INTERVAL_MS, 700, 2000, 1);
+#if ENABLE_STORM
+  schedEvery("storm", stormTick, 1, 0, STORM_DRAIN_BUDGET_US + 1000, 3);
+#endif
 }
 
 void loop(){
-  server.handleClient();
-  dnsServer.processNextRequest(); // Atender las peticiones DNS
-
-  unsigned long now = millis();
-  if (now - lastScan >= SCAN_INTERVAL_MS){ lastScan = now; runScan(); }
+  uint32_t t_loop = micros();
+  {
+    TRACE_SCOPE(TR_HANDLE_CLIENT);
+    server.handleClient();
+  }
+  uint32_t t_dns = micros();
+  {
+    TRACE_SCOPE(TR_DNS);
+    dnsServer.processNextRequest(); // Atender las peticiones DNS
+  }
+  histObserve(metrics.dns, micros() - t_dns);
 
-  static uint32_t t_rssi=0;
-  if (millis()-t_rssi > 2000){ t_rssi = millis(); refreshRSSIConnected(); }
+  // Mantenimiento: como mucho un trabajo vencido por iteración
+  schedRun();
 
-  static uint32_t t_prune=0;
-  if (millis()-t_prune > 5000){ t_prune = millis(); prunePending(); }
+  histObserve(metrics.loop, micros() - t_loop);
 }
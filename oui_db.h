@@ -0,0 +1,50 @@
+// GENERADO por tools/gen_oui.py - no editar a mano.
+// 37 OUIs, 20 fabricantes, 353 bytes de nombres.
+#pragma once
+#include <stdint.h>
+
+constexpr uint32_t OUI_COUNT = 37;
+constexpr uint32_t OUI_BUCKETS = 10;
+constexpr uint32_t OUI_SEED = 1;
+constexpr uint16_t OUI_DISP[10] = {
+  14,16,1,16,3,0,7,136,29,1196,
+};
+constexpr uint32_t OUI_KEYS[37] = {
+  0x0050F2,0x00146C,0x30AEA4,0x000A95,0x3C5AB4,0x0000F0,0xF01898,0x7C9EBD,
+  0x00E0FC,0xDCA632,0xA4CF12,0x3C0754,0x00E04C,0x000C29,0x001422,0x000D3A,
+  0xAC67B2,0x000569,0x3CD92B,0x240AC4,0x00037F,0x00155D,0x50C7BF,0x246F28,
+  0x001CB3,0x001018,0x8CAAB5,0x000393,0x005056,0xE45F01,0x00000C,0xB827EB,
+  0x001B21,0x080027,0xF4F5D8,0x001A11,0x3C71BF,
+};
+constexpr uint16_t OUI_NAME_IDX[37] = {
+  10,12,5,0,6,17,0,5,7,16,5,0,
+  14,19,4,11,5,19,8,5,1,11,18,5,
+  0,2,5,0,19,16,3,15,9,13,6,6,
+  5,
+};
+constexpr uint32_t OUI_NAME_OFF[20] = {
+  0,11,34,43,62,71,85,97,120,136,152,167,
+  189,197,220,245,269,294,317,341,
+};
+constexpr char OUI_NAMES[] =
+  "Apple, Inc\0"
+  "Atheros Communications\0"
+  "Broadcom\0"
+  "Cisco Systems, Inc\0"
+  "Dell Inc\0"
+  "Espressif Inc\0"
+  "Google, Inc\0"
+  "HUAWEI TECHNOLOGIES CO\0"
+  "Hewlett Packard\0"
+  "Intel Corporate\0"
+  "MICROSOFT CORP\0"
+  "Microsoft Corporation\0"
+  "NETGEAR\0"
+  "PCS Systemtechnik GmbH\0"
+  "REALTEK SEMICONDUCTOR CO\0"
+  "Raspberry Pi Foundation\0"
+  "Raspberry Pi Trading Ltd\0"
+  "Samsung Electronics Co\0"
+  "TP-LINK TECHNOLOGIES CO\0"
+  "VMware, Inc\0"
+  ;
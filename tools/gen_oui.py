@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+# Genera oui_db.h a partir del registro MA-L de la IEEE (oui.csv).
+#   python3 tools/gen_oui.py oui.csv > oui_db.h
+#   (descarga: https://standards-oui.ieee.org/oui/oui.csv)
+#
+# Salida: arreglos constexpr (quedan en flash) con un hash perfecto mínimo tipo
+# "hash and displace": OUI -> cubeta -> desplazamiento -> posición única en [0, N).
+# Se guarda la clave para rechazar OUIs ausentes y los nombres se deduplican.
+# Las funciones de hash deben coincidir con ouiMix/ouiLookup en main.cpp.
+import csv, sys, argparse
+
+def mix(x):
+    x &= 0xFFFFFFFF
+    x ^= x >> 16; x = (x * 0x85EBCA6B) & 0xFFFFFFFF
+    x ^= x >> 13; x = (x * 0xC2B2AE35) & 0xFFFFFFFF
+    x ^= x >> 16
+    return x
+
+def build(keys, seed):
+    n = len(keys)
+    nb = max(1, (n + 3) // 4)
+    buckets = [[] for _ in range(nb)]
+    for k in keys: buckets[mix(k ^ seed) % nb].append(k)
+    disp = [0] * nb
+    used = [False] * n
+    for b in sorted(range(nb), key=lambda i: -len(buckets[i])):
+        if not buckets[b]: continue
+        for d in range(1, 65536):
+            slots = [mix(k ^ (d * 0x9E3779B9)) % n for k in buckets[b]]
+            if len(set(slots)) == len(slots) and not any(used[s] for s in slots):
+                for s in slots: used[s] = True
+                disp[b] = d
+                break
+        else:
+            return None
+    return nb, disp
+
+def clean(name, maxlen):
+    name = " ".join(name.split())
+    return name[:maxlen].rstrip(" ,.")
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("csv")
+    ap.add_argument("--max-name", type=int, default=24, help="trunca nombres para ahorrar flash")
+    a = ap.parse_args()
+
+    db = {}
+    with open(a.csv, newline="", encoding="utf-8") as f:
+        for row in csv.DictReader(f):
+            if row.get("Registry", "MA-L") != "MA-L": continue
+            db[int(row["Assignment"], 16)] = clean(row["Organization Name"], a.max_name)
+    keys = sorted(db)
+    n = len(keys)
+
+    for seed in range(1, 1000):
+        r = build(keys, seed)
+        if r: break
+    else:
+        sys.exit("no se encontró hash perfecto")
+    nb, disp = r
+
+    names = sorted(set(db.values()))
+    name_id = {s: i for i, s in enumerate(names)}
+    offs, blob = [], b""
+    for s in names:
+        offs.append(len(blob)); blob += s.encode("utf-8") + b"\0"
+
+    slot_key = [0] * n
+    nbk = [[] for _ in range(nb)]
+    for k in keys: nbk[mix(k ^ seed) % nb].append(k)
+    for b in range(nb):
+        for k in nbk[b]: slot_key[mix(k ^ (disp[b] * 0x9E3779B9)) % n] = k
+
+    out = sys.stdout
+    out.write("// GENERADO por tools/gen_oui.py - no editar a mano.\n")
+    out.write("// %d OUIs, %d fabricantes, %d bytes de nombres.\n" % (n, len(names), len(blob)))
+    out.write("#pragma once\n#include <stdint.h>\n\n")
+    out.write("constexpr uint32_t OUI_COUNT = %d;\n" % n)
+    out.write("constexpr uint32_t OUI_BUCKETS = %d;\n" % nb)
+    out.write("constexpr uint32_t OUI_SEED = %d;\n" % seed)
+    def arr(t, name, vals, per=12, fmt="%d"):
+        out.write("constexpr %s %s[%d] = {\n" % (t, name, len(vals)))
+        for i in range(0, len(vals), per):
+            out.write("  " + ",".join(fmt % v for v in vals[i:i+per]) + ",\n")
+        out.write("};\n")
+    arr("uint16_t", "OUI_DISP", disp)
+    arr("uint32_t", "OUI_KEYS", slot_key, 8, "0x%06X")
+    arr("uint16_t", "OUI_NAME_IDX", [name_id[db[k]] for k in slot_key])
+    arr("uint32_t", "OUI_NAME_OFF", offs)
+    out.write("constexpr char OUI_NAMES[] =\n")
+    for s in names: out.write('  "%s\\0"\n' % s.replace("\\", "\\\\").replace('"', '\\"'))
+    out.write("  ;\n")
+
+if __name__ == "__main__":
+    main()